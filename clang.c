@@ -18,6 +18,7 @@
 #include "cpp-include.h"
 #include "lexer.h"
 #include "options.h"
+#include "profile.h"
 #include "token.h"
 #include "util.h"
 
@@ -287,8 +288,15 @@ out:
 			break;
 		}
 	}
-	if (tk->tk_type == LEXER_EOF)
+	if (tk->tk_type == LEXER_EOF) {
 		clang_branch_purge(cl, lx);
+	} else if (nlines > 0 && VECTOR_EMPTY(cl->cl_branches)) {
+		/*
+		 * The next token starts on a new line and no cpp branch is
+		 * pending, reading can therefore resume from the next token.
+		 */
+		tk->tk_flags |= TOKEN_FLAG_RESUME;
+	}
 
 	return tk;
 }
@@ -533,6 +541,8 @@ again:
 		tk->tk_flags |= TOKEN_FLAG_DIRTY;
 		tk->tk_len = buffer_get_len(bf);
 		tk->tk_str = buffer_release(bf);
+		profile_alloc(PROFILE_TOKEN, "STRING", NULL, 0,
+		    tk->tk_len + 1);
 	}
 	buffer_free(bf);
 
@@ -613,6 +623,8 @@ clang_read_cpp(struct clang *cl, struct lexer *lx)
 		tk->tk_flags |= TOKEN_FLAG_DIRTY;
 		tk->tk_str = str;
 		tk->tk_len = strlen(str);
+		profile_alloc(PROFILE_TOKEN, "STRING", NULL, 0,
+		    tk->tk_len + 1);
 	}
 
 	/* Discard any remaining hard line(s). */
@@ -12,47 +12,69 @@
 #include "token.h"
 #include "util.h"
 
+static int		 isindent(const char *, size_t, size_t, int);
 static const char	*nextline(const char *, size_t);
 static const char	*skipws(const char *, size_t);
 static size_t		 rskipws(const char *, size_t);
 
+/*
+ * Re-indent and strip trailing whitespace from the given multi-line comment.
+ * Returns NULL if the comment is already trimmed, sparing the allocation and
+ * copy in the common case of well-formatted source code.
+ */
 struct buffer *
 comment_trim(const struct token *tk, const struct style *st)
 {
-	struct buffer *bf;
+	struct buffer *bf = NULL;
 	const char *sp = tk->tk_str;
 	size_t len = tk->tk_len;
+	int usetabs = style_use_tabs(st);
 	int iscrlf;
 
 	if (len == 0 || sp[len - 1] != '\n')
 		return NULL;
 
 	iscrlf = len >= 2 && sp[len - 2] == '\r';
-	bf = buffer_alloc(len);
-	if (bf == NULL)
-		err(1, NULL);
 	for (;;) {
 		const char *ep;
-		size_t commlen;
+		size_t indent = 0;
+		size_t wslen = 0;
+		size_t commlen, textlen;
+		int reindent = 0;
 
 		ep = skipws(sp, len);
 		if (ep != NULL && (*ep == '*' || *ep == '/')) {
-			size_t wslen;
-
 			wslen = (size_t)(ep - sp);
-			strindent_buffer(bf, strwidth(sp, wslen, 0),
-			    style_use_tabs(st), 0);
-			len -= wslen;
-			sp += wslen;
+			indent = strwidth(sp, wslen, 0);
+			reindent = 1;
 		}
-		ep = nextline(sp, len);
+		ep = nextline(&sp[wslen], len - wslen);
 		if (ep == NULL)
 			break;
 		commlen = (size_t)(ep - sp);
-		buffer_puts(bf, sp, rskipws(sp, commlen));
-		if (iscrlf)
-			buffer_putc(bf, '\r');
-		buffer_putc(bf, '\n');
+		textlen = rskipws(&sp[wslen], commlen - wslen);
+
+		/*
+		 * Delay the allocation until the first line in need of
+		 * trimming, all preceding lines are copied verbatim.
+		 */
+		if (bf == NULL &&
+		    ((reindent && !isindent(sp, wslen, indent, usetabs)) ||
+		     commlen - wslen != textlen + (size_t)iscrlf + 1 ||
+		     (iscrlf && sp[wslen + textlen] != '\r'))) {
+			bf = buffer_alloc(tk->tk_len);
+			if (bf == NULL)
+				err(1, NULL);
+			buffer_puts(bf, tk->tk_str, (size_t)(sp - tk->tk_str));
+		}
+		if (bf != NULL) {
+			if (reindent)
+				strindent_buffer(bf, indent, usetabs, 0);
+			buffer_puts(bf, &sp[wslen], textlen);
+			if (iscrlf)
+				buffer_putc(bf, '\r');
+			buffer_putc(bf, '\n');
+		}
 
 		len -= commlen;
 		sp += commlen;
@@ -61,6 +83,30 @@ comment_trim(const struct token *tk, const struct style *st)
 	return bf;
 }
 
+/*
+ * Returns non-zero if the given whitespace equals the one emitted by
+ * strindent_buffer() for the given indentation.
+ */
+static int
+isindent(const char *str, size_t len, size_t indent, int usetabs)
+{
+	size_t ntabs = usetabs ? indent / 8 : 0;
+	size_t nspaces = indent - ntabs * 8;
+	size_t i;
+
+	if (len != ntabs + nspaces)
+		return 0;
+	for (i = 0; i < ntabs; i++) {
+		if (str[i] != '\t')
+			return 0;
+	}
+	for (; i < len; i++) {
+		if (str[i] != ' ')
+			return 0;
+	}
+	return 1;
+}
+
 static const char *
 nextline(const char *str, size_t len)
 {
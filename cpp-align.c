@@ -10,6 +10,7 @@
 
 #include "doc.h"
 #include "options.h"
+#include "rope.h"
 #include "ruler.h"
 #include "style.h"
 #include "token.h"
@@ -143,6 +144,7 @@ cpp_align(struct token *tk, const struct style *st, const struct options *op)
 	};
 	struct ruler rl;
 	struct buffer *bf;
+	struct rope *rp;
 	struct doc *dc;
 	const char *nx, *str;
 	char *p = NULL;
@@ -179,6 +181,7 @@ cpp_align(struct token *tk, const struct style *st, const struct options *op)
 	bf = buffer_alloc(len);
 	if (bf == NULL)
 		err(1, NULL);
+	rp = rope_alloc(NULL);
 	dc = doc_alloc(DOC_CONCAT, NULL);
 
 	for (;;) {
@@ -199,7 +202,7 @@ cpp_align(struct token *tk, const struct style *st, const struct options *op)
 			doc_literal_n(sp, cpplen, concat);
 		w = doc_width(&(struct doc_exec_arg){
 		    .dc	= concat,
-		    .bf	= bf,
+		    .rp	= rp,
 		    .st	= st,
 		    .op	= op,
 		});
@@ -222,18 +225,20 @@ cpp_align(struct token *tk, const struct style *st, const struct options *op)
 	if (nlines <= 1)
 		goto out;
 	ruler_exec(&rl);
-	buffer_reset(bf);
+	rope_reset(rp);
 	doc_exec(&(struct doc_exec_arg){
 	    .dc	= dc,
-	    .bf	= bf,
+	    .rp	= rp,
 	    .st	= st,
 	    .op	= op,
 	});
+	rope_flatten(rp, bf);
 
 	p = buffer_str(bf);
 out:
 	ruler_free(&rl);
 	doc_free(dc);
+	rope_free(rp);
 	buffer_free(bf);
 	return p;
 }
@@ -151,6 +151,36 @@ out:
 	return error;
 }
 
+/*
+ * Parse the given line range on the form start:end into a diff chunk. Returns
+ * non-zero on error.
+ */
+int
+diff_parse_range(const char *str, struct diffchunk *du)
+{
+	const char *p = str;
+	char *end;
+	long beg, fin;
+
+	errno = 0;
+	beg = strtol(p, &end, 10);
+	if (errno || end == p || *end != ':' || beg <= 0 || beg > INT_MAX)
+		goto err;
+	p = &end[1];
+	errno = 0;
+	fin = strtol(p, &end, 10);
+	if (errno || end == p || *end != '\0' || fin < beg || fin > INT_MAX)
+		goto err;
+
+	du->du_beg = (unsigned int)beg;
+	du->du_end = (unsigned int)fin;
+	return 0;
+
+err:
+	warnx("%s: invalid line range", str);
+	return 1;
+}
+
 const struct diffchunk *
 diff_get_chunk(const struct diffchunk *chunks, unsigned int lno)
 {
@@ -9,4 +9,5 @@ struct diffchunk {
 void			 diff_init(void);
 void			 diff_shutdown(void);
 int			 diff_parse(struct files *, const struct options *);
+int			 diff_parse_range(const char *, struct diffchunk *);
 const struct diffchunk	*diff_get_chunk(const struct diffchunk *, unsigned int);
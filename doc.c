@@ -21,8 +21,12 @@
 #include "alloc.h"
 #include "diff.h"
 #include "lexer.h"
+#include "options.h"
+#include "profile.h"
+#include "rope.h"
 #include "style.h"
 #include "token.h"
+#include "tracelog.h"
 #include "util.h"
 
 #ifdef HAVE_QUEUE
@@ -50,6 +54,20 @@ struct doc {
 	const char	*dc_fun;
 	const char	*dc_suffix;
 
+	/* parent, used to invalidate the cached width */
+	struct doc	*dc_parent;
+
+	/* cached width, see doc_width_flat() */
+	struct {
+		unsigned int	w;
+		unsigned int	flags;
+#define DOC_WIDTH_VALID		0x00000001u
+/* Could emit new line(s) or depends on the current column. */
+#define DOC_WIDTH_NOFLAT	0x00000002u
+/* Contains optional line(s) not nested under an optional document. */
+#define DOC_WIDTH_OPTLINE	0x00000004u
+	} dc_width;
+
 	/* children */
 	union {
 		struct doc_list	 dc_list;
@@ -79,7 +97,7 @@ struct doc_state_indent {
 struct doc_state {
 	const struct options		*st_op;
 	const struct style		*st_st;
-	struct buffer			*st_bf;
+	struct rope			*st_rp;
 	struct lexer			*st_lx;
 	const struct diffchunk		*st_diff_chunks;
 
@@ -133,11 +151,8 @@ struct doc_state {
 };
 
 struct doc_state_snapshot {
-	struct doc_state sn_st;
-	struct {
-		char	*ptr;
-		size_t	 len;
-	} sn_bf;
+	struct doc_state	sn_st;
+	struct rope_mark	sn_mark;
 };
 
 /*
@@ -155,6 +170,8 @@ struct doc_diff {
 struct doc_fits {
 	int		fits;
 	unsigned int	optline;
+	unsigned int	lno;	/* line of first token */
+	unsigned long	nwalk;	/* # walked documents */
 };
 
 /*
@@ -271,7 +288,10 @@ static void		doc_trim_lines(const struct doc *, struct doc_state *);
 static int		doc_is_mute(const struct doc_state *);
 static int		doc_parens_align(const struct doc_state *);
 static int		doc_has_list(const struct doc *);
+static unsigned int	doc_lno(const struct doc *);
 static unsigned int	doc_column(struct doc_state *, const char *, size_t);
+static void		doc_width_flat(struct doc *);
+static void		doc_width_invalidate(struct doc *);
 static int		doc_max1(const struct doc *, struct doc_state *,
     void *);
 
@@ -283,7 +303,6 @@ static void	doc_state_snapshot(struct doc_state_snapshot *,
     const struct doc_state *);
 static void	doc_state_snapshot_restore(const struct doc_state_snapshot *,
     struct doc_state *);
-static void	doc_state_snapshot_reset(struct doc_state_snapshot *);
 
 #define DOC_DIFF(st) (((st)->st_flags & DOC_EXEC_DIFF))
 
@@ -337,21 +356,35 @@ static void	doc_trace_enter0(const struct doc *, struct doc_state *);
 		doc_trace_leave0((dc), (st));				\
 } while (0)
 static void	doc_trace_leave0(const struct doc *, struct doc_state *);
+static void	doc_tracelog_enter(const struct doc *, const struct doc_state *,
+    unsigned int);
 
 static char		*docstr(const struct doc *, char *, size_t);
 static void		 indentstr(const struct doc *,
     const struct doc_state *, struct buffer *);
 static const char	*statestr(const struct doc_state *, unsigned int,
     char *, size_t);
+static int		 statemode(const struct doc_state *);
+static int		 statemute(const struct doc_state *);
 
 static unsigned int	countlines(const char *, size_t);
 
+/*
+ * Document discarding everything appended to it, see doc_sink().
+ */
+static struct doc sink;
+
+#define doc_is_sink(dc) ((dc) == &sink)
+
 void
 doc_exec(struct doc_exec_arg *arg)
 {
 	const struct doc *dc = arg->dc;
 	struct doc_state st;
 
+	if (doc_is_sink(dc))
+		return;
+
 	doc_state_init(&st, arg, BREAK);
 	doc_exec1(dc, &st);
 	if (arg->flags & DOC_EXEC_TRIM)
@@ -366,6 +399,15 @@ doc_width(struct doc_exec_arg *arg)
 {
 	struct doc_state st;
 
+	if (doc_is_sink(arg->dc))
+		return 0;
+
+	/* Ugly, must be mutable for caching. */
+	doc_width_flat((struct doc *)arg->dc);
+	if ((arg->dc->dc_width.flags & DOC_WIDTH_NOFLAT) == 0 &&
+	    arg->dc->dc_width.w <= style(arg->st, ColumnLimit))
+		return arg->dc->dc_width.w;
+
 	doc_state_init(&st, arg, MUNGE);
 	doc_exec1(arg->dc, &st);
 	doc_state_reset(&st);
@@ -377,7 +419,7 @@ doc_free(struct doc *dc)
 {
 	const struct doc_description *desc;
 
-	if (dc == NULL)
+	if (dc == NULL || doc_is_sink(dc))
 		return;
 	desc = &doc_descriptions[dc->dc_type];
 
@@ -396,17 +438,23 @@ doc_free(struct doc *dc)
 		if (dc->dc_tk != NULL)
 			token_rele(dc->dc_tk);
 	} else if (desc->value.minimizers) {
+		profile_free(PROFILE_DOC, VECTOR_LENGTH(dc->dc_minimizers) *
+		    sizeof(*dc->dc_minimizers));
 		VECTOR_FREE(dc->dc_minimizers);
 	}
 
+	profile_free(PROFILE_DOC, sizeof(*dc));
 	free(dc);
 }
 
 void
 doc_remove(struct doc *dc, struct doc *parent)
 {
+	if (doc_is_sink(parent))
+		return;
 	assert(doc_has_list(parent));
 	TAILQ_REMOVE(&parent->dc_list, dc, dc_entry);
+	doc_width_invalidate(parent);
 	doc_free(dc);
 }
 
@@ -415,11 +463,14 @@ doc_remove_tail(struct doc *parent)
 {
 	struct doc *dc;
 
+	if (doc_is_sink(parent))
+		return 0;
 	assert(doc_has_list(parent));
 	dc = TAILQ_LAST(&parent->dc_list, doc_list);
 	if (dc == NULL)
 		return 0;
 	TAILQ_REMOVE(&parent->dc_list, dc, dc_entry);
+	doc_width_invalidate(parent);
 	doc_free(dc);
 	return 1;
 }
@@ -427,36 +478,63 @@ doc_remove_tail(struct doc *parent)
 void
 doc_set_indent(struct doc *dc, unsigned int indent)
 {
+	if (doc_is_sink(dc))
+		return;
 	dc->dc_int = (int)indent;
+	doc_width_invalidate(dc);
 }
 
 void
 doc_set_dedent(struct doc *dc, unsigned int indent)
 {
+	if (doc_is_sink(dc))
+		return;
 	dc->dc_int = -(int)indent;
+	doc_width_invalidate(dc);
 }
 
 void
 doc_set_align(struct doc *dc, const struct doc_align *align)
 {
+	if (doc_is_sink(dc))
+		return;
 	dc->dc_align = *align;
+	doc_width_invalidate(dc);
 }
 
 void
 doc_append(struct doc *dc, struct doc *parent)
 {
+	if (doc_is_sink(parent)) {
+		doc_free(dc);
+		return;
+	}
+	if (doc_is_sink(dc))
+		return;
+
 	if (doc_has_list(parent)) {
 		TAILQ_INSERT_TAIL(&parent->dc_list, dc, dc_entry);
 	} else {
 		assert(parent->dc_doc == NULL);
 		parent->dc_doc = dc;
 	}
+	dc->dc_parent = parent;
+	doc_width_invalidate(parent);
 }
 
 void
 doc_append_before(struct doc *dc, struct doc *before)
 {
+	if (doc_is_sink(before)) {
+		doc_free(dc);
+		return;
+	}
+	if (doc_is_sink(dc))
+		return;
+
 	TAILQ_INSERT_BEFORE(before, dc, dc_entry);
+	dc->dc_parent = before->dc_parent;
+	doc_width_invalidate(dc->dc_parent);
 }
 
 struct doc *
@@ -465,7 +543,14 @@ doc_alloc0(enum doc_type type, struct doc *parent, int val, const char *fun,
 {
 	struct doc *dc;
 
+	if (doc_is_sink(parent))
+		return parent;
+
 	dc = ecalloc(1, sizeof(*dc));
+	profile_alloc(PROFILE_DOC, doc_descriptions[type].name, fun, lno,
+	    sizeof(*dc));
+	/* Not attributed to any line as only the parser knows the token. */
+	profile_cost(PROFILE_COST_DOC, 0, 1);
 	dc->dc_type = type;
 	dc->dc_fun = fun;
 	dc->dc_lno = lno;
@@ -515,6 +600,9 @@ doc_minimize0(const struct doc_minimize *minimizers, size_t nminimizers,
 	struct doc *dc;
 	size_t i;
 
+	if (doc_is_sink(parent))
+		return parent;
+
 	dc = doc_alloc0(DOC_MINIMIZE, parent, 0, fun, lno);
 	if (VECTOR_INIT(dc->dc_minimizers))
 		err(1, NULL);
@@ -528,6 +616,8 @@ doc_minimize0(const struct doc_minimize *minimizers, size_t nminimizers,
 			err(1, NULL);
 		*dst = minimizers[i];
 	}
+	profile_alloc(PROFILE_DOC, "MINIMIZER", fun, lno,
+	    nminimizers * sizeof(*minimizers));
 	return doc_alloc0(DOC_CONCAT, dc, 0, fun, lno);
 }
 
@@ -537,6 +627,9 @@ doc_literal0(const char *str, size_t len, struct doc *dc, const char *fun,
 {
 	struct doc *literal;
 
+	if (doc_is_sink(dc))
+		return dc;
+
 	literal = doc_alloc0(DOC_LITERAL, dc, 0, fun, lno);
 	literal->dc_str = str;
 	literal->dc_len = len > 0 ? len : strlen(str);
@@ -550,6 +643,9 @@ doc_token0(const struct token *tk, struct doc *dc, enum doc_type type,
 	struct doc *token;
 	struct token *nx, *prefix, *suffix;
 
+	if (doc_is_sink(dc))
+		return dc;
+
 	if (tk->tk_flags & TOKEN_FLAG_UNMUTE)
 		doc_alloc0(DOC_MUTE, dc, -1, fun, lno);
 
@@ -582,6 +678,18 @@ doc_token0(const struct token *tk, struct doc *dc, enum doc_type type,
 	return token;
 }
 
+/*
+ * Returns a document discarding everything appended to it, allowing the
+ * parser to speculate without constructing documents. Documents allocated
+ * with the sink as its parent are never allocated, the sink itself is instead
+ * returned.
+ */
+struct doc *
+doc_sink(void)
+{
+	return &sink;
+}
+
 /*
  * Returns the maximum value associated with the given document.
  */
@@ -592,6 +700,9 @@ doc_max(const struct doc *dc)
 	struct doc_exec_arg arg = {0};
 	int max = 0;
 
+	if (doc_is_sink(dc))
+		return 0;
+
 	doc_state_init(&st, &arg, BREAK);
 	doc_walk(dc, &st, doc_max1, &max);
 	doc_state_reset(&st);
@@ -601,6 +712,8 @@ doc_max(const struct doc *dc)
 void
 doc_annotate(struct doc *dc, const char *suffix)
 {
+	if (doc_is_sink(dc))
+		return;
 	dc->dc_suffix = suffix;
 }
 
@@ -901,6 +1014,7 @@ doc_exec_minimize_indent(const struct doc *cdc, struct doc_state *st)
 	size_t i;
 	unsigned int nlines = 0;
 	unsigned int nexceeds = 0;
+	unsigned int lno;
 	double minpenality = DBL_MAX;
 
 	if (st->st_minimize.idx != -1) {
@@ -908,6 +1022,7 @@ doc_exec_minimize_indent(const struct doc *cdc, struct doc_state *st)
 		return;
 	}
 
+	lno = doc_lno(dc);
 	doc_state_snapshot(&sn, st);
 	minimizers = dc->dc_minimizers;
 	for (i = 0; i < VECTOR_LENGTH(minimizers); i++) {
@@ -916,6 +1031,7 @@ doc_exec_minimize_indent(const struct doc *cdc, struct doc_state *st)
 		st->st_flags &= ~DOC_EXEC_TRACE;
 
 		st->st_minimize.idx = i;
+		profile_cost(PROFILE_COST_MINIMIZE, lno, 1);
 		doc_exec_minimize_indent1(dc, st, i);
 		st->st_minimize.idx = -1;
 		if (st->st_minimize.force != -1)
@@ -929,7 +1045,6 @@ doc_exec_minimize_indent(const struct doc *cdc, struct doc_state *st)
 		doc_state_snapshot_restore(&sn, st);
 	}
 	dc->dc_minimizers = minimizers;
-	doc_state_snapshot_reset(&sn);
 
 	for (i = 0; i < VECTOR_LENGTH(dc->dc_minimizers); i++) {
 		struct doc_minimize *mi = &dc->dc_minimizers[i];
@@ -1065,11 +1180,13 @@ doc_fits(const struct doc *dc, struct doc_state *st)
 
 	memcpy(&fst, st, sizeof(fst));
 	/* Should not perform any printing. */
-	fst.st_bf = NULL;
+	fst.st_rp = NULL;
 	fst.st_mode = MUNGE;
 	fst.st_walk = NULL;
 	doc_walk(dc, &fst, doc_fits1, &fits);
 	doc_state_reset(&fst);
+	profile_cost(PROFILE_COST_FITS, fits.lno, 1);
+	profile_cost(PROFILE_COST_WALK, fits.lno, fits.nwalk);
 	col = fst.st_col;
 	optline = fits.optline;
 	doc_trace(dc, st, "%s: %u %s %u, optline %u", __func__,
@@ -1084,6 +1201,11 @@ doc_fits1(const struct doc *dc, struct doc_state *st, void *arg)
 {
 	struct doc_fits *fits = arg;
 
+	fits->nwalk++;
+	if (fits->lno == 0 && doc_descriptions[dc->dc_type].children.token &&
+	    dc->dc_tk != NULL)
+		fits->lno = dc->dc_tk->tk_lno;
+
 	if (st->st_newline) {
 		fits->fits = st->st_col <= style(st->st_st, ColumnLimit);
 		return 0;
@@ -1169,7 +1291,16 @@ doc_print_indent1(const struct doc *UNUSED(dc), struct doc_state *st,
 {
 	unsigned int oldcol = st->st_col;
 
-	st->st_col = strindent_buffer(st->st_bf, indent, usetabs, st->st_col);
+	if (usetabs) {
+		for (; indent >= 8; indent -= 8) {
+			rope_putc(st->st_rp, '\t');
+			st->st_col += 8 - (st->st_col % 8);
+		}
+	}
+	for (; indent > 0; indent--) {
+		rope_putc(st->st_rp, ' ');
+		st->st_col++;
+	}
 	return st->st_col - oldcol;
 }
 
@@ -1232,7 +1363,7 @@ doc_print(const struct doc *dc, struct doc_state *st, const char *str,
 			st->st_minimize.idx = -1;
 	}
 	if (!ismute)
-		buffer_puts(st->st_bf, str, len);
+		rope_puts(st->st_rp, str, len);
 	doc_column(st, str, len);
 
 	if (isnewline && (flags & DOC_PRINT_INDENT))
@@ -1244,17 +1375,15 @@ doc_print(const struct doc *dc, struct doc_state *st, const char *str,
 static void
 doc_trim_spaces(const struct doc *dc, struct doc_state *st)
 {
-	const char *buf = buffer_get_ptr(st->st_bf);
-	size_t buflen = buffer_get_len(st->st_bf);
 	unsigned int oldcol = st->st_col;
 
-	while (buflen > 0) {
-		char ch;
+	for (;;) {
+		int ch;
 
-		ch = buf[buflen - 1];
+		ch = rope_back(st->st_rp, 1);
 		if (ch != ' ' && ch != '\t')
 			break;
-		buflen -= buffer_pop(st->st_bf, 1);
+		rope_pop(st->st_rp, 1);
 		st->st_col -= ch == '\t' ? 8 - (st->st_col % 8) : 1;
 	}
 	if (oldcol > st->st_col) {
@@ -1271,13 +1400,11 @@ doc_trim_spaces(const struct doc *dc, struct doc_state *st)
 static void
 doc_trim_lines(const struct doc *dc, struct doc_state *st)
 {
-	const char *buf = buffer_get_ptr(st->st_bf);
-	size_t buflen = buffer_get_len(st->st_bf);
 	int ntrim = 0;
 
-	while (buflen > 1 &&
-	    buf[buflen - 1] == '\n' && buf[buflen - 2] == '\n') {
-		buflen -= buffer_pop(st->st_bf, 1);
+	while (rope_back(st->st_rp, 1) == '\n' &&
+	    rope_back(st->st_rp, 2) == '\n') {
+		rope_pop(st->st_rp, 1);
 		ntrim++;
 	}
 	if (ntrim > 0)
@@ -1643,18 +1770,18 @@ doc_is_mute(const struct doc_state *st)
 static int
 doc_parens_align(const struct doc_state *st)
 {
-	const char *buf = buffer_get_ptr(st->st_bf);
-	size_t buflen = buffer_get_len(st->st_bf);
+	size_t i = 1;
 	int nparens = 0;
+	int ch;
 
-	for (; buflen > 0 && buf[buflen - 1] == '('; buflen--)
+	for (; (ch = rope_back(st->st_rp, i)) == '('; i++)
 		nparens++;
-	if (nparens == 0 || buflen == 0)
+	if (nparens == 0 || ch == -1)
 		return 0;
-	for (; buflen > 0; buflen--) {
-		if (buf[buflen - 1] == '\n')
+	for (; (ch = rope_back(st->st_rp, i)) != -1; i++) {
+		if (ch == '\n')
 			break;
-		if (buf[buflen - 1] != ' ' && buf[buflen - 1] != '\t')
+		if (ch != ' ' && ch != '\t')
 			return 0;
 	}
 	return 1;
@@ -1666,6 +1793,35 @@ doc_has_list(const struct doc *dc)
 	return doc_descriptions[dc->dc_type].children.many;
 }
 
+/*
+ * Returns the line number of the first token in the given document, or zero if
+ * no such token is found.
+ */
+static unsigned int
+doc_lno(const struct doc *dc)
+{
+	const struct doc_description *desc = &doc_descriptions[dc->dc_type];
+
+	if (desc->children.many) {
+		const struct doc *concat;
+
+		TAILQ_FOREACH(concat, &dc->dc_list, dc_entry) {
+			unsigned int lno;
+
+			lno = doc_lno(concat);
+			if (lno > 0)
+				return lno;
+		}
+	} else if (desc->children.one) {
+		if (dc->dc_doc != NULL)
+			return doc_lno(dc->dc_doc);
+	} else if (desc->children.token) {
+		if (dc->dc_tk != NULL)
+			return dc->dc_tk->tk_lno;
+	}
+	return 0;
+}
+
 /*
  * Set the column position, intended to be given the same string just added to
  * the document buffer.
@@ -1687,6 +1843,114 @@ doc_column(struct doc_state *st, const char *str, size_t len)
 	return st->st_col > oldcol ? st->st_col - oldcol : 0;
 }
 
+/*
+ * Get the width of the given document assuming everything fits on a single
+ * line, only columns are tracked. The width is cached on the document and
+ * recalculated once the document or any nested document is altered. The
+ * DOC_WIDTH_NOFLAT flag is set if the width cannot be determined without
+ * executing the document.
+ */
+static void
+doc_width_flat(struct doc *dc)
+{
+	const struct doc_description *desc = &doc_descriptions[dc->dc_type];
+	unsigned int flags = 0;
+	unsigned int w = 0;
+
+	if (dc->dc_width.flags & DOC_WIDTH_VALID)
+		return;
+
+	if (desc->children.many) {
+		struct doc *concat;
+
+		TAILQ_FOREACH(concat, &dc->dc_list, dc_entry) {
+			doc_width_flat(concat);
+			w += concat->dc_width.w;
+			flags |= concat->dc_width.flags;
+		}
+	} else if (desc->children.one && dc->dc_doc != NULL) {
+		doc_width_flat(dc->dc_doc);
+		w += dc->dc_doc->dc_width.w;
+		flags |= dc->dc_doc->dc_width.flags;
+	}
+
+	switch (dc->dc_type) {
+	case DOC_INDENT:
+		if (IS_DOC_INDENT_FORCE(dc->dc_int))
+			flags |= DOC_WIDTH_NOFLAT;
+		break;
+
+	case DOC_MINIMIZE: {
+		size_t i;
+
+		for (i = 0; i < VECTOR_LENGTH(dc->dc_minimizers); i++) {
+			if (IS_DOC_INDENT_FORCE(dc->dc_minimizers[i].indent))
+				flags |= DOC_WIDTH_NOFLAT;
+		}
+		break;
+	}
+
+	case DOC_ALIGN:
+		if (dc->dc_align.tabalign)
+			flags |= DOC_WIDTH_NOFLAT;
+		else
+			w += dc->dc_align.indent + dc->dc_align.spaces;
+		break;
+
+	case DOC_LITERAL:
+		/* Tabs are relative to the current column. */
+		if (memchr(dc->dc_str, '\t', dc->dc_len) != NULL ||
+		    memchr(dc->dc_str, '\n', dc->dc_len) != NULL)
+			flags |= DOC_WIDTH_NOFLAT;
+		else
+			w += (unsigned int)dc->dc_len;
+		break;
+
+	case DOC_LINE:
+		w++;
+		break;
+
+	case DOC_OPTLINE:
+		flags |= DOC_WIDTH_OPTLINE;
+		break;
+
+	case DOC_OPTIONAL:
+		if (flags & DOC_WIDTH_OPTLINE)
+			flags |= DOC_WIDTH_NOFLAT;
+		break;
+
+	case DOC_NOINDENT:
+	case DOC_VERBATIM:
+	case DOC_HARDLINE:
+		flags |= DOC_WIDTH_NOFLAT;
+		break;
+
+	case DOC_CONCAT:
+	case DOC_GROUP:
+	case DOC_SOFTLINE:
+	case DOC_MUTE:
+	case DOC_SCOPE:
+	case DOC_MAXLINES:
+		break;
+	}
+
+	dc->dc_width.w = w;
+	dc->dc_width.flags = flags | DOC_WIDTH_VALID;
+}
+
+/*
+ * Invalidate the cached width of the given document and all its parents. A
+ * document with a valid width implies that all nested documents also have a
+ * valid width, the traversal can therefore stop at the first invalid one.
+ */
+static void
+doc_width_invalidate(struct doc *dc)
+{
+	for (; dc != NULL && (dc->dc_width.flags & DOC_WIDTH_VALID);
+	    dc = dc->dc_parent)
+		dc->dc_width.flags &= ~DOC_WIDTH_VALID;
+}
+
 static int
 doc_max1(const struct doc *dc, struct doc_state *UNUSED(st), void *arg)
 {
@@ -1713,7 +1977,7 @@ doc_state_init(struct doc_state *st, struct doc_exec_arg *arg,
 	memset(st, 0, sizeof(*st));
 	st->st_op = arg->op;
 	st->st_st = arg->st;
-	st->st_bf = arg->bf;
+	st->st_rp = arg->rp;
 	st->st_lx = arg->lx;
 	st->st_diff_chunks = arg->diff_chunks;
 	st->st_maxlines = 2;
@@ -1744,30 +2008,16 @@ doc_state_reset_lines(struct doc_state *st)
 static void
 doc_state_snapshot(struct doc_state_snapshot *sn, const struct doc_state *st)
 {
-	const char *buf = buffer_get_ptr(st->st_bf);
-	size_t buflen = buffer_get_len(st->st_bf);
-
 	sn->sn_st = *st;
-	sn->sn_bf.ptr = emalloc(buflen);
-	sn->sn_bf.len = buflen;
-	memcpy(sn->sn_bf.ptr, buf, buflen);
+	rope_mark(st->st_rp, &sn->sn_mark);
 }
 
 static void
 doc_state_snapshot_restore(const struct doc_state_snapshot *sn,
     struct doc_state *st)
 {
-	struct buffer *bf = st->st_bf;
-
 	*st = sn->sn_st;
-	buffer_reset(bf);
-	buffer_puts(bf, sn->sn_bf.ptr, sn->sn_bf.len);
-}
-
-static void
-doc_state_snapshot_reset(struct doc_state_snapshot *sn)
-{
-	free(sn->sn_bf.ptr);
+	rope_restore(st->st_rp, &sn->sn_mark);
 }
 
 static void
@@ -1778,6 +2028,18 @@ doc_trace0(const struct doc *UNUSED(dc), const struct doc_state *st,
 	va_list ap;
 	unsigned int depth, i;
 
+	if (st->st_op->tracelog) {
+		char msg[128];
+
+		va_start(ap, fmt);
+		(void)vsnprintf(msg, sizeof(msg), fmt, ap);
+		va_end(ap);
+		tracelog(TRACELOG_DOC_MESSAGE, statemode(st), st->st_col,
+		    st->st_depth, statemute(st), st->st_optline, st->st_depth,
+		    msg);
+		return;
+	}
+
 	fprintf(stderr, "%s", statestr(st, st->st_depth, buf, sizeof(buf)));
 	depth = st->st_depth * 2 + 1;
 	for (i = 0; i < depth; i++)
@@ -1800,6 +2062,11 @@ doc_trace_enter0(const struct doc *dc, struct doc_state *st)
 
 	st->st_depth++;
 
+	if (st->st_op->tracelog) {
+		doc_tracelog_enter(dc, st, depth);
+		return;
+	}
+
 	fprintf(stderr, "%s ", statestr(st, st->st_depth, buf, sizeof(buf)));
 
 	for (i = 0; i < depth; i++)
@@ -1886,6 +2153,13 @@ doc_trace_leave0(const struct doc *dc, struct doc_state *st)
 	if (!desc->children.many && !desc->children.one)
 		return;
 
+	if (st->st_op->tracelog) {
+		tracelog(TRACELOG_DOC_LEAVE, statemode(st), st->st_col, depth,
+		    statemute(st), st->st_optline, st->st_depth,
+		    desc->children.many ? "]" : "");
+		return;
+	}
+
 	fprintf(stderr, "%s ", statestr(st, depth, buf, sizeof(buf)));
 	for (i = 0; i < st->st_depth; i++)
 		fprintf(stderr, "  ");
@@ -1896,6 +2170,39 @@ doc_trace_leave0(const struct doc *dc, struct doc_state *st)
 	fprintf(stderr, "\n");
 }
 
+/*
+ * Record the entry of the given document in the event log. Compared to
+ * doc_trace_enter0(), only the document value is recorded.
+ */
+static void
+doc_tracelog_enter(const struct doc *dc, const struct doc_state *st,
+    unsigned int depth)
+{
+	const struct doc_description *desc = &doc_descriptions[dc->dc_type];
+	int mode = statemode(st);
+	int mute = statemute(st);
+
+	if (desc->value.string) {
+		char str[64];
+		size_t len;
+
+		len = dc->dc_len < sizeof(str) ? dc->dc_len : sizeof(str) - 1;
+		memcpy(str, dc->dc_str, len);
+		str[len] = '\0';
+		tracelog(TRACELOG_DOC_ENTER_STRING, mode, st->st_col,
+		    st->st_depth, mute, st->st_optline, depth, desc->name,
+		    dc->dc_fun, dc->dc_lno, str);
+	} else if (desc->value.integer) {
+		tracelog(TRACELOG_DOC_ENTER_INT, mode, st->st_col,
+		    st->st_depth, mute, st->st_optline, depth, desc->name,
+		    dc->dc_fun, dc->dc_lno, dc->dc_int);
+	} else {
+		tracelog(TRACELOG_DOC_ENTER, mode, st->st_col, st->st_depth,
+		    mute, st->st_optline, depth, desc->name, dc->dc_fun,
+		    dc->dc_lno, desc->children.many ? "[" : "");
+	}
+}
+
 static char *
 docstr(const struct doc *dc, char *buf, size_t bufsiz)
 {
@@ -1945,30 +2252,41 @@ statestr(const struct doc_state *st, unsigned int depth, char *buf,
     size_t bufsiz)
 {
 	char mute[16];
-	unsigned char mode = 'U';
 	int n;
 
-	switch (st->st_mode) {
-	case BREAK:
-		mode = 'B';
-		break;
-	case MUNGE:
-		mode = 'M';
-		break;
-	}
-
 	if (doc_diff_is_mute(st))
 		(void)snprintf(mute, sizeof(mute), "D");
 	else
 		(void)snprintf(mute, sizeof(mute), "%d", st->st_mute);
 
 	n = snprintf(buf, bufsiz, "[D] [%c C=%-3u D=%-3u U=%s O=%d]",
-	    mode, st->st_col, depth, mute, st->st_optline);
+	    statemode(st), st->st_col, depth, mute, st->st_optline);
 	if (n < 0 || n >= (ssize_t)bufsiz)
 		errc(1, ENAMETOOLONG, "%s", __func__);
 	return buf;
 }
 
+static int
+statemode(const struct doc_state *st)
+{
+	switch (st->st_mode) {
+	case BREAK:
+		return 'B';
+	case MUNGE:
+		return 'M';
+	}
+	return 'U';
+}
+
+/*
+ * Get the mute state, where -1 denotes being muted by the diff.
+ */
+static int
+statemute(const struct doc_state *st)
+{
+	return doc_diff_is_mute(st) ? -1 : st->st_mute;
+}
+
 static unsigned int
 countlines(const char *str, size_t len)
 {
@@ -27,7 +27,7 @@ struct doc_exec_arg {
 	const struct doc	*dc;
 	struct lexer		*lx;
 	const struct diffchunk	*diff_chunks;
-	struct buffer		*bf;
+	struct rope		*rp;
 	const struct style	*st;
 	const struct options	*op;
 	unsigned int		 flags;
@@ -124,6 +124,8 @@ struct doc	*doc_token0(const struct token *, struct doc *, enum doc_type,
 #define doc_max_lines(a, b) \
 	doc_alloc0(DOC_MAXLINES, (b), (a), __func__, __LINE__)
 
+struct doc	*doc_sink(void);
+
 int	doc_max(const struct doc *);
 
 void	doc_annotate(struct doc *, const char *);
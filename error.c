@@ -60,18 +60,22 @@ error_reset(struct error *er)
 		buffer_reset(er->er_bf);
 }
 
-void
+/*
+ * Returns non-zero if any error was flushed.
+ */
+int
 error_flush(struct error *er, int force)
 {
 	size_t buflen;
 
 	if (er->er_bf == NULL)
-		return;
+		return 0;
 	if (!force && !er->er_flush)
-		return;
+		return 0;
 
 	buflen = buffer_get_len(er->er_bf);
 	if (buflen > 0)
 		fprintf(stderr, "%.*s", (int)buflen, buffer_get_ptr(er->er_bf));
 	error_reset(er);
+	return buflen > 0;
 }
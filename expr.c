@@ -7,7 +7,6 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "libks/buffer.h"
 #include "libks/compiler.h"
 #include "libks/consistency.h"
 #include "libks/vector.h"
@@ -16,6 +15,8 @@
 #include "doc.h"
 #include "lexer.h"
 #include "options.h"
+#include "profile.h"
+#include "rope.h"
 #include "ruler.h"
 #include "simple.h"
 #include "style.h"
@@ -74,21 +75,68 @@ enum expr_type {
 #undef OP
 };
 
+/*
+ * Expression node. Nodes are allocated from a pool and never freed
+ * individually, therefore no node owns any memory except for the recover
+ * document.
+ */
 struct expr {
 	enum expr_type	 ex_type;
 	struct token	*ex_tk;
-	struct expr	*ex_lhs;
+	struct expr	*ex_lhs;	/* next recover expr if EXPR_RECOVER */
 	struct expr	*ex_rhs;
 	struct token	*ex_tokens[2];
 
 	union {
-		struct expr		*ex_ternary;
-		struct doc		*ex_dc;
-		int			 ex_sizeof;
-		VECTOR(struct expr *)	 ex_concat;
+		struct expr	*ex_ternary;
+		struct doc	*ex_dc;
+		int		 ex_sizeof;
+		/*
+		 * Concatenated literals are linked together, the first literal
+		 * is the right hand side of the concat expression.
+		 */
+		struct expr	*ex_next;	/* EXPR_LITERAL */
+		struct expr	*ex_last;	/* EXPR_CONCAT */
 	};
 };
 
+/*
+ * Minimum number of binary operators in a chain for expr_doc_chain() to kick
+ * in.
+ */
+#define EXPR_CHAIN_MIN	16
+
+/* Number of expressions per chunk. */
+#define EXPR_CHUNK_SIZE	64
+
+struct expr_chunk {
+	struct expr_chunk	*next;
+	size_t			 len;
+	struct expr		 exprs[EXPR_CHUNK_SIZE];
+};
+
+/*
+ * Pool of expressions, allowing an entire expression tree to be discarded at
+ * once.
+ */
+struct expr_pool {
+	struct expr_chunk	*head;		/* most recently allocated */
+	struct expr_chunk	*tail;
+	struct expr		*recover;	/* expressions owning a document */
+};
+
+/*
+ * Expression tree constructed by expr_peek() which can be reused by a
+ * subsequent expr_exec() covering the same tokens.
+ */
+struct expr_cache {
+	struct expr_pool	 pool;
+	struct expr_chunk	*chunks;	/* no longer used by any pool */
+	struct expr		*ex;
+	struct token		*beg;	/* first token */
+	struct token		*end;	/* last token */
+};
+
 struct expr_state;
 
 struct expr_rule {
@@ -106,14 +154,17 @@ struct expr_state {
 #define es_dc		es_ea.dc
 #define es_flags	es_ea.flags
 
+	enum expr_mode		 es_mode;
 	const struct expr_rule	*es_er;
 	struct token		*es_tk;
-	struct buffer		*es_bf;
+	struct rope		*es_rp;
+	struct expr_pool	 es_pool;
 	unsigned int		 es_depth;
 	unsigned int		 es_nassign;	/* # nested binary assignments */
 	unsigned int		 es_ncalls;	/* # nested calls */
 	unsigned int		 es_noparens;	/* parens indent disabled */
 	unsigned int		 es_col;	/* ruler column */
+	unsigned int		 es_nrecover;	/* # recovered expressions */
 };
 
 static struct expr	*expr_exec1(struct expr_state *, enum expr_pc);
@@ -133,8 +184,9 @@ static struct expr	*expr_exec_unary(struct expr_state *, struct expr *);
 
 static int	expr_exec_peek(struct expr_state *, struct token **);
 
-static struct expr	*expr_alloc(enum expr_type, const struct expr_state *);
-static void		 expr_free(struct expr *);
+static struct expr	*expr_alloc(enum expr_type, struct expr_state *);
+
+static void	expr_pool_reset(struct expr_pool *, struct expr_chunk **);
 
 static struct doc	*expr_doc(struct expr *, struct expr_state *,
     struct doc *);
@@ -142,6 +194,8 @@ static struct doc	*expr_doc_unary(struct expr *, struct expr_state *,
     struct doc *);
 static struct doc	*expr_doc_binary(struct expr *, struct expr_state *,
     struct doc *);
+static struct doc	*expr_doc_chain(struct expr *, struct expr_state *,
+    struct doc *);
 static struct doc	*expr_doc_parens(struct expr *, struct expr_state *,
     struct doc *);
 static struct doc	*expr_doc_field(struct expr *, struct expr_state *,
@@ -158,6 +212,7 @@ static struct doc	*expr_doc_ternary(struct expr *, struct expr_state *,
     struct doc *);
 static struct doc	*expr_doc_recover(struct expr *, struct expr_state *,
     struct doc *);
+static struct doc	*expr_doc_recover_alloc(const struct expr_state *);
 
 #define expr_doc_align(a, b, c, d) \
 	expr_doc_align0((a), (b), (c), (d), __func__, __LINE__)
@@ -187,6 +242,14 @@ static void	expr_state_init(struct expr_state *,
     const struct expr_exec_arg *, enum expr_mode);
 static void	expr_state_reset(struct expr_state *);
 
+static int		expr_is_chain(const struct expr *);
+static unsigned int	expr_chain_len(const struct expr *);
+
+static struct expr	*expr_cache_get(struct expr_cache *,
+    struct expr_state *);
+static void		 expr_cache_set(struct expr_cache *,
+    struct expr_state *, struct expr *, struct token *, struct token *);
+
 static const struct expr_rule	*expr_find_rule(const struct token *, int);
 
 static void	token_move_next_line(struct token *);
@@ -287,11 +350,6 @@ expr_init(void)
 	}
 }
 
-void
-expr_shutdown(void)
-{
-}
-
 struct doc *
 expr_exec(const struct expr_exec_arg *ea)
 {
@@ -301,11 +359,11 @@ expr_exec(const struct expr_exec_arg *ea)
 
 	expr_state_init(&es, ea, EXPR_MODE_EXEC);
 
-	ex = expr_exec1(&es, PC0);
+	ex = expr_cache_get(ea->cache, &es);
 	if (ex == NULL)
-		return NULL;
-	if (lexer_get_error(ea->lx)) {
-		expr_free(ex);
+		ex = expr_exec1(&es, PC0);
+	if (ex == NULL || lexer_get_error(ea->lx)) {
+		expr_state_reset(&es);
 		return NULL;
 	}
 
@@ -327,7 +385,6 @@ expr_exec(const struct expr_exec_arg *ea)
 		indent = doc_alloc(DOC_OPTIONAL, indent);
 	}
 	expr = expr_doc(ex, &es, indent);
-	expr_free(ex);
 	expr_state_reset(&es);
 	return expr;
 }
@@ -339,20 +396,65 @@ expr_peek(const struct expr_exec_arg *ea, struct token **tk)
 	struct lexer_state s;
 	struct expr *ex;
 	struct lexer *lx = ea->lx;
+	struct token *beg = NULL;
 	int peek = 0;
 
 	expr_state_init(&es, ea, EXPR_MODE_PEEK);
 
 	lexer_peek_enter(lx, &s);
+	lexer_peek(lx, &beg);
 	ex = expr_exec1(&es, PC0);
 	if (ex != NULL && lexer_get_error(lx) == 0 && lexer_back(lx, tk))
 		peek = 1;
 	lexer_peek_leave(lx, &s);
-	expr_free(ex);
+	/*
+	 * Documents emitted by the recover callbacks depend on the context and
+	 * can therefore not be reused.
+	 */
+	if (peek && ea->cache != NULL && es.es_nrecover == 0)
+		expr_cache_set(ea->cache, &es, ex, beg, *tk);
 	expr_state_reset(&es);
 	return peek;
 }
 
+struct expr_cache *
+expr_cache_alloc(void)
+{
+	return ecalloc(1, sizeof(struct expr_cache));
+}
+
+void
+expr_cache_free(struct expr_cache *ec)
+{
+	if (ec == NULL)
+		return;
+	expr_cache_reset(ec);
+	while (ec->chunks != NULL) {
+		struct expr_chunk *ch = ec->chunks;
+
+		ec->chunks = ch->next;
+		profile_free(PROFILE_EXPR, sizeof(*ch));
+		free(ch);
+	}
+	free(ec);
+}
+
+/*
+ * Release all cached expressions, retaining allocations for later reuse.
+ */
+void
+expr_cache_reset(struct expr_cache *ec)
+{
+	expr_pool_reset(&ec->pool, &ec->chunks);
+	ec->ex = NULL;
+	if (ec->beg != NULL)
+		token_rele(ec->beg);
+	ec->beg = NULL;
+	if (ec->end != NULL)
+		token_rele(ec->end);
+	ec->end = NULL;
+}
+
 static struct expr *
 expr_exec1(struct expr_state *es, enum expr_pc pc)
 {
@@ -402,12 +504,8 @@ expr_exec1(struct expr_state *es, enum expr_pc pc)
 		if (!lexer_pop(es->es_lx, &es->es_tk))
 			break;
 		tmp = er->er_func(es, ex);
-		if (tmp == NULL)
-			return NULL;
-		if (lexer_get_error(es->es_lx)) {
-			expr_free(tmp);
+		if (tmp == NULL || lexer_get_error(es->es_lx))
 			return NULL;
-		}
 		ex = tmp;
 	}
 
@@ -421,13 +519,16 @@ expr_exec_recover(struct expr_state *es)
 	struct doc *dc;
 	struct expr *ex;
 
-	dc = doc_alloc(DOC_CONCAT, NULL);
+	dc = expr_doc_recover_alloc(es);
 	if (!ea->callbacks.recover(ea, dc, ea->callbacks.arg)) {
 		doc_free(dc);
 		return NULL;
 	}
 	ex = expr_alloc(EXPR_RECOVER, es);
 	ex->ex_dc = dc;
+	ex->ex_lhs = es->es_pool.recover;
+	es->es_pool.recover = ex;
+	es->es_nrecover++;
 	return ex;
 }
 
@@ -438,13 +539,16 @@ expr_exec_recover_cast(struct expr_state *es)
 	struct doc *dc;
 	struct expr *ex;
 
-	dc = doc_alloc(DOC_CONCAT, NULL);
+	dc = expr_doc_recover_alloc(es);
 	if (!ea->callbacks.recover_cast(ea, dc, ea->callbacks.arg)) {
 		doc_free(dc);
 		return NULL;
 	}
 	ex = expr_alloc(EXPR_RECOVER, es);
 	ex->ex_dc = dc;
+	ex->ex_lhs = es->es_pool.recover;
+	es->es_pool.recover = ex;
+	es->es_nrecover++;
 	return ex;
 }
 
@@ -468,27 +572,20 @@ expr_exec_binary(struct expr_state *es, struct expr *lhs)
 static struct expr *
 expr_exec_concat(struct expr_state *es, struct expr *lhs)
 {
-	struct expr **dst;
 	struct expr *ex, *rhs;
 
 	assert(lhs != NULL);
 
+	rhs = expr_exec_literal(es, NULL);
 	if (lhs->ex_type == EXPR_CONCAT) {
 		ex = lhs;
+		ex->ex_last->ex_next = rhs;
 	} else {
 		ex = expr_alloc(EXPR_CONCAT, es);
-		if (VECTOR_INIT(ex->ex_concat))
-			err(1, NULL);
-		dst = VECTOR_ALLOC(ex->ex_concat);
-		if (dst == NULL)
-			err(1, NULL);
-		*dst = lhs;
+		ex->ex_lhs = lhs;
+		ex->ex_rhs = rhs;
 	}
-	rhs = expr_exec_literal(es, NULL);
-	dst = VECTOR_ALLOC(ex->ex_concat);
-	if (dst == NULL)
-		err(1, NULL);
-	*dst = rhs;
+	ex->ex_last = rhs;
 	return ex;
 }
 
@@ -617,10 +714,8 @@ expr_exec_ternary(struct expr_state *es, struct expr *lhs)
 	if (lexer_expect(es->es_lx, TOKEN_COLON, &tk))
 		ex->ex_tokens[1] = tk;	/* : */
 	ex->ex_ternary = expr_exec1(es, PC0);
-	if (ex->ex_ternary == NULL) {
-		expr_free(ex);
+	if (ex->ex_ternary == NULL)
 		return NULL;
-	}
 	return ex;
 }
 
@@ -653,38 +748,66 @@ expr_exec_peek(struct expr_state *es, struct token **tk)
 }
 
 static struct expr *
-expr_alloc(enum expr_type type, const struct expr_state *es)
+expr_alloc(enum expr_type type, struct expr_state *es)
 {
+	struct expr_pool *pool = &es->es_pool;
+	struct expr_chunk *ch = pool->head;
 	struct expr *ex;
 
-	ex = ecalloc(1, sizeof(*ex));
+	if (ch == NULL || ch->len == EXPR_CHUNK_SIZE) {
+		struct expr_cache *ec = es->es_ea.cache;
+
+		if (ec != NULL && ec->chunks != NULL) {
+			ch = ec->chunks;
+			ec->chunks = ch->next;
+		} else {
+			ch = emalloc(sizeof(*ch));
+			profile_alloc(PROFILE_EXPR, "CHUNK", NULL, 0,
+			    sizeof(*ch));
+		}
+		ch->next = pool->head;
+		ch->len = 0;
+		pool->head = ch;
+		if (pool->tail == NULL)
+			pool->tail = ch;
+	}
+
+	ex = &ch->exprs[ch->len++];
+	memset(ex, 0, sizeof(*ex));
 	ex->ex_type = type;
 	ex->ex_tk = es->es_tk;
 	return ex;
 }
 
+/*
+ * Discard all expressions allocated from the pool. The chunks are kept around
+ * for reuse if the given list is not NULL.
+ */
 static void
-expr_free(struct expr *ex)
+expr_pool_reset(struct expr_pool *pool, struct expr_chunk **chunks)
 {
-	if (ex == NULL)
-		return;
+	struct expr *ex;
+
+	for (ex = pool->recover; ex != NULL; ex = ex->ex_lhs)
+		doc_free(ex->ex_dc);
+	pool->recover = NULL;
 
-	expr_free(ex->ex_lhs);
-	expr_free(ex->ex_rhs);
-	if (ex->ex_type == EXPR_TERNARY) {
-		expr_free(ex->ex_ternary);
-	} else if (ex->ex_type == EXPR_CONCAT) {
-		while (!VECTOR_EMPTY(ex->ex_concat)) {
-			struct expr **tail;
+	if (pool->head == NULL)
+		return;
+	if (chunks != NULL) {
+		pool->tail->next = *chunks;
+		*chunks = pool->head;
+	} else {
+		struct expr_chunk *ch;
 
-			tail = VECTOR_POP(ex->ex_concat);
-			expr_free(*tail);
+		while ((ch = pool->head) != NULL) {
+			pool->head = ch->next;
+			profile_free(PROFILE_EXPR, sizeof(*ch));
+			free(ch);
 		}
-		VECTOR_FREE(ex->ex_concat);
-	} else if (ex->ex_type == EXPR_RECOVER) {
-		doc_free(ex->ex_dc);
 	}
-	free(ex);
+	pool->head = NULL;
+	pool->tail = NULL;
 }
 
 static struct doc *
@@ -836,6 +959,8 @@ expr_doc_binary(struct expr *ex, struct expr_state *es, struct doc *dc)
 			}
 		}
 		es->es_nassign--;
+	} else if (!es->es_op->test && expr_chain_len(ex) >= EXPR_CHAIN_MIN) {
+		dc = expr_doc_chain(ex, es, dc);
 	} else if (style(st, BreakBeforeBinaryOperators) == NonAssignment ||
 	    style(st, BreakBeforeBinaryOperators) == All) {
 		struct doc *lhs;
@@ -889,6 +1014,85 @@ expr_doc_binary(struct expr *ex, struct expr_state *es, struct doc *dc)
 	return dc;
 }
 
+/*
+ * Construct the document for a long chain of binary operators, as commonly
+ * found in machine generated code. The documents are identical to the ones
+ * emitted by expr_doc_binary() except for the nesting, each operand is instead
+ * emitted on the same level keeping both the recursion and the depth of the
+ * document bounded. Alignment of the operands is therefore only considered once
+ * for the whole chain.
+ */
+static struct doc *
+expr_doc_chain(struct expr *ex, struct expr_state *es, struct doc *dc)
+{
+	VECTOR(struct expr *) chain;
+	const struct style *st = es->es_st;
+	struct doc *lhs;
+	size_t i;
+	int breakbefore;
+
+	breakbefore =
+	    style(st, BreakBeforeBinaryOperators) == NonAssignment ||
+	    style(st, BreakBeforeBinaryOperators) == All;
+	if (style(st, AlignOperands) == Align)
+		dc = expr_doc_align(ex, es, dc, 0);
+
+	if (VECTOR_INIT(chain))
+		err(1, NULL);
+	for (; expr_is_chain(ex); ex = ex->ex_lhs) {
+		struct expr **dst;
+
+		dst = VECTOR_ALLOC(chain);
+		if (dst == NULL)
+			err(1, NULL);
+		*dst = ex;
+		if (breakbefore)
+			token_move_next_line(ex->ex_tk);
+		else
+			token_move_prev_line(ex->ex_tk);
+	}
+
+	lhs = expr_doc(ex, es, dc);
+	for (i = VECTOR_LENGTH(chain); i > 0; i--) {
+		struct doc *concat;
+		int dospace;
+
+		ex = chain[i - 1];
+		dospace = expr_doc_has_spaces(ex);
+		if (breakbefore) {
+			if (dospace)
+				doc_alloc(DOC_LINE, lhs);
+			concat = doc_alloc(DOC_CONCAT,
+			    doc_alloc(DOC_GROUP, dc));
+			doc_alloc(DOC_SOFTLINE, concat);
+			doc_token(ex->ex_tk, concat);
+			if (dospace)
+				doc_literal(" ", concat);
+			lhs = ex->ex_rhs != NULL ?
+			    expr_doc(ex->ex_rhs, es, concat) : concat;
+			continue;
+		}
+
+		if (dospace)
+			doc_literal(" ", lhs);
+		doc_token(ex->ex_tk, lhs);
+		concat = doc_alloc(DOC_CONCAT, doc_alloc(DOC_GROUP, dc));
+		if (token_has_suffix(ex->ex_tk, TOKEN_COMMENT) &&
+		    token_has_line(ex->ex_tk, 1))
+			doc_alloc(DOC_HARDLINE, lhs);
+		else if (dospace)
+			doc_alloc(DOC_LINE, concat);
+		if (ex->ex_rhs != NULL) {
+			lhs = expr_doc_soft(ex->ex_rhs, es, concat,
+			    soft_weights.binary);
+		} else {
+			lhs = concat;
+		}
+	}
+	VECTOR_FREE(chain);
+	return lhs;
+}
+
 static struct doc *
 expr_doc_parens(struct expr *ex, struct expr_state *es, struct doc *dc)
 {
@@ -1048,23 +1252,22 @@ static struct doc *
 expr_doc_concat(struct expr *ex, struct expr_state *es, struct doc *dc)
 {
 	struct token *pv;
-	size_t i, n;
+	struct expr *e, *nx;
 
 	if (style(es->es_st, AlignOperands) == Align &&
 	    es->es_ncalls == 0 &&
-	    (pv = token_prev(ex->ex_concat[0]->ex_tk)) != NULL &&
+	    (pv = token_prev(ex->ex_lhs->ex_tk)) != NULL &&
 	    !token_has_line(pv, 1))
 		dc = expr_doc_align(ex, es, dc, 0);
-	n = VECTOR_LENGTH(ex->ex_concat);
-	for (i = 0; i < n; i++) {
-		struct expr *e = ex->ex_concat[i];
+	for (e = ex->ex_lhs; e != NULL; e = nx) {
 		struct doc *tmp;
 
+		nx = e == ex->ex_lhs ? ex->ex_rhs : e->ex_next;
 		tmp = expr_doc(e, es, dc);
-		if (i + 1 < n)
+		if (nx != NULL)
 			doc_alloc(DOC_LINE, tmp);
 		/* Nest subsequent expressions under the first one. */
-		if (i == 0)
+		if (e == ex->ex_lhs)
 			dc = tmp;
 	}
 	return dc;
@@ -1149,6 +1352,18 @@ expr_doc_recover(struct expr *ex, struct expr_state *es, struct doc *dc)
 	return dc;
 }
 
+/*
+ * Allocate the document passed to the recover callbacks. While peeking, the
+ * document is never used and is therefore a sink.
+ */
+static struct doc *
+expr_doc_recover_alloc(const struct expr_state *es)
+{
+	if (es->es_mode == EXPR_MODE_PEEK)
+		return doc_sink();
+	return doc_alloc(DOC_CONCAT, NULL);
+}
+
 /*
  * Favor alignment with what we got so far on the current line, assuming it does
  * not cause exceesive new line(s). Otherwise, fallback to regular indentation.
@@ -1219,14 +1434,13 @@ expr_doc_has_spaces(const struct expr *ex)
 static unsigned int
 expr_doc_width(struct expr_state *es, const struct doc *dc)
 {
-	if (es->es_bf == NULL) {
-		es->es_bf = buffer_alloc(1024);
-		if (es->es_bf == NULL)
-			err(1, NULL);
-	}
+	if (es->es_rp == NULL)
+		es->es_rp = rope_alloc(NULL);
+	else
+		rope_reset(es->es_rp);
 	return doc_width(&(struct doc_exec_arg){
 	    .dc	= dc,
-	    .bf	= es->es_bf,
+	    .rp	= es->es_rp,
 	    .st	= es->es_st,
 	    .op	= es->es_op,
 	});
@@ -1263,7 +1477,7 @@ expr_doc_soft0(struct expr *ex, struct expr_state *es, struct doc *dc,
 
 static void
 expr_state_init(struct expr_state *es, const struct expr_exec_arg *ea,
-    enum expr_mode MAYBE_UNUSED(mode))
+    enum expr_mode mode)
 {
 	ASSERT_CONSISTENCY(mode == EXPR_MODE_EXEC, ea->si);
 	ASSERT_CONSISTENCY(ea->flags & EXPR_EXEC_ALIGN, ea->rl);
@@ -1271,12 +1485,107 @@ expr_state_init(struct expr_state *es, const struct expr_exec_arg *ea,
 
 	memset(es, 0, sizeof(*es));
 	es->es_ea = *ea;
+	es->es_mode = mode;
 }
 
 static void
 expr_state_reset(struct expr_state *es)
 {
-	buffer_free(es->es_bf);
+	struct expr_cache *ec = es->es_ea.cache;
+
+	rope_free(es->es_rp);
+	expr_pool_reset(&es->es_pool, ec != NULL ? &ec->chunks : NULL);
+}
+
+/*
+ * Get the cached expression tree if it starts at the next token and covers
+ * the same tokens as the expression parser would. The lexer is positioned
+ * after the expression on success and left untouched otherwise. Any cached
+ * expression tree is discarded.
+ */
+static struct expr *
+expr_cache_get(struct expr_cache *ec, struct expr_state *es)
+{
+	struct lexer_state st;
+	struct expr *ex;
+	struct token *tk;
+
+	if (ec == NULL || ec->ex == NULL)
+		return NULL;
+
+	if (!lexer_peek(es->es_lx, &tk) || tk != ec->beg ||
+	    (es->es_ea.stop != NULL && es->es_ea.stop != token_next(ec->end))) {
+		expr_cache_reset(ec);
+		return NULL;
+	}
+	st = lexer_get_state(es->es_lx);
+	while (lexer_pop(es->es_lx, &tk) && tk != ec->end)
+		continue;
+	if (tk != ec->end) {
+		/* Let the caller parse the expression from the same position. */
+		lexer_set_state(es->es_lx, &st);
+		expr_cache_reset(ec);
+		return NULL;
+	}
+
+	/* The expression state is now responsible for the pool. */
+	ex = ec->ex;
+	es->es_pool = ec->pool;
+	memset(&ec->pool, 0, sizeof(ec->pool));
+	ec->ex = NULL;
+	expr_cache_reset(ec);
+	return ex;
+}
+
+static void
+expr_cache_set(struct expr_cache *ec, struct expr_state *es, struct expr *ex,
+    struct token *beg, struct token *end)
+{
+	struct token *tk;
+
+	expr_cache_reset(ec);
+
+	/*
+	 * Branches are traversed differently while peeking, the cached
+	 * expression tree can therefore not span across them.
+	 */
+	for (tk = beg; tk != end; tk = token_next(tk)) {
+		if (tk == NULL || token_is_branch(tk) ||
+		    token_get_branch(tk) != NULL)
+			break;
+	}
+	if (tk != end || token_is_branch(end))
+		return;
+
+	token_ref(beg);
+	token_ref(end);
+	ec->ex = ex;
+	ec->beg = beg;
+	ec->end = end;
+	/* The cache is now responsible for the pool. */
+	ec->pool = es->es_pool;
+	memset(&es->es_pool, 0, sizeof(es->es_pool));
+}
+
+static int
+expr_is_chain(const struct expr *ex)
+{
+	return ex->ex_type == EXPR_BINARY &&
+	    (ex->ex_tk->tk_flags & TOKEN_FLAG_ASSIGN) == 0;
+}
+
+/*
+ * Get the number of binary operators along the left hand side of the given
+ * expression, bounded by EXPR_CHAIN_MIN.
+ */
+static unsigned int
+expr_chain_len(const struct expr *ex)
+{
+	unsigned int len = 0;
+
+	for (; len < EXPR_CHAIN_MIN && expr_is_chain(ex); ex = ex->ex_lhs)
+		len++;
+	return len;
 }
 
 static const struct expr_rule *
@@ -13,6 +13,12 @@ struct expr_exec_arg {
 	 */
 	const struct token	*stop;
 
+	/*
+	 * Optional cache, allowing the expression tree constructed by
+	 * expr_peek() to be reused by a subsequent expr_exec().
+	 */
+	struct expr_cache	*cache;
+
 	unsigned int		 indent;
 	/*
 	 * Optional alignment taking higher predence than indent when
@@ -54,7 +60,10 @@ struct expr_exec_arg {
 };
 
 void	expr_init(void);
-void	expr_shutdown(void);
 
 struct doc	*expr_exec(const struct expr_exec_arg *);
 int		 expr_peek(const struct expr_exec_arg *, struct token **);
+
+struct expr_cache	*expr_cache_alloc(void);
+void			 expr_cache_free(struct expr_cache *);
+void			 expr_cache_reset(struct expr_cache *);
@@ -1,3 +1,5 @@
+struct buffer;
+
 struct files {
 	struct file	*fs_vc;			/* VECTOR(struct file) */
 };
@@ -11,5 +13,5 @@ struct file {
 struct file	*files_alloc(struct files *, const char *);
 void		 files_free(struct files *);
 
-struct buffer	*file_read(struct file *);
-void		 file_close(struct file *);
+int	file_read(struct file *, struct buffer *);
+void	file_close(struct file *);
@@ -0,0 +1,109 @@
+#include "config.h"
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "libks/buffer.h"
+
+#include "clang.h"
+#include "expr.h"
+#include "lexer.h"
+#include "options.h"
+#include "parser.h"
+#include "profile.h"
+#include "rope.h"
+#include "simple.h"
+#include "style.h"
+#include "token.h"
+
+/*
+ * Default maximum amount of work of any kind per byte of source code. The most
+ * demanding kind of work across a corpus of real world source code, the number
+ * of tokens scanned while peeking, stays below a third of this limit.
+ */
+#define FUZZ_FACTOR	64
+
+/*
+ * Format source code read from standard input and abort if any kind of work
+ * exceeds the source code size by the given factor, allowing a fuzzer to find
+ * and minimize inputs causing superlinear behavior.
+ */
+int
+main(int argc, char *argv[])
+{
+	struct options op;
+	struct buffer *src;
+	struct clang *cl;
+	struct lexer *lx;
+	struct parser *pr = NULL;
+	struct simple *si;
+	struct style *st;
+	unsigned long factor = FUZZ_FACTOR;
+	unsigned long limit;
+	size_t i;
+	int error = 0;
+
+	if (argc > 1) {
+		char *end;
+
+		factor = strtoul(argv[1], &end, 10);
+		if (end == argv[1] || *end != '\0' || factor == 0)
+			errx(1, "%s: invalid factor", argv[1]);
+	}
+
+	options_init(&op);
+	/* Enable accounting of work, see profile_cost(). */
+	if (options_trace_parse(&op, "p"))
+		return 1;
+	profile_init(&op);
+	clang_init();
+	expr_init();
+	style_init();
+
+	src = buffer_read_fd(0);
+	if (src == NULL)
+		err(1, "/dev/stdin");
+	/* Also tolerate some fixed amount of work for tiny inputs. */
+	limit = factor * (buffer_get_len(src) + 64);
+
+	st = style_parse_buffer(NULL, ".clang-format", &op);
+	si = simple_alloc(&op);
+	cl = clang_alloc(st, si, &op);
+	lx = lexer_alloc(&(const struct lexer_arg){
+	    .path	= "/dev/stdin",
+	    .bf		= src,
+	    .op		= &op,
+	    .callbacks	= {
+		.read		= clang_read,
+		.alloc		= token_alloc,
+		.serialize	= token_serialize,
+		.arg		= cl,
+	    },
+	});
+	if (lx != NULL) {
+		pr = parser_alloc(lx, st, si, &op);
+		(void)parser_exec(pr, NULL, src);
+	}
+
+	for (i = 0; i < PROFILE_COST_LAST; i++) {
+		if (profile_cost_get((enum profile_cost)i) > limit)
+			error = 1;
+	}
+	if (error) {
+		fprintf(stderr, "work exceeds %lu\n", limit);
+		profile_cost_report("/dev/stdin");
+		abort();
+	}
+
+	parser_free(pr);
+	lexer_free(lx);
+	clang_free(cl);
+	simple_free(si);
+	style_free(st);
+	buffer_free(src);
+	style_shutdown();
+	clang_shutdown();
+	profile_shutdown();
+	return 0;
+}
@@ -7,8 +7,10 @@
 #include <err.h>
 #include <errno.h>
 #include <limits.h>	/* PATH_MAX */
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "libks/buffer.h"
@@ -22,34 +24,54 @@
 #include "lexer.h"
 #include "options.h"
 #include "parser.h"
+#include "profile.h"
+#include "rope.h"
 #include "simple.h"
+#include "split.h"
 #include "style.h"
 #include "token.h"
+#include "tracelog.h"
+#include "watch.h"
+
+/* Allocations reused across files, see fileformat(). */
+struct context {
+	struct buffer		*cx_src;
+	struct lexer		*cx_lx;
+	struct parser		*cx_pr;
+	struct style_cache	*cx_sc;
+	const struct style	*cx_st;
+	struct clang		*cx_cl;
+};
 
 static void	usage(void) __attribute__((__noreturn__));
 
-static int	filelist(int, char **, struct files *, const struct options *);
-static int	fileformat(struct file *, const struct style *, struct simple *,
-    struct clang *, const struct options *);
-static int	filediff(const struct buffer *, const struct buffer *,
+static int	filelist(int, char **, struct files *,
+    const struct diffchunk *, const struct options *);
+static int	filewatch(int, char **, struct context *, const char *,
+    struct simple *, const struct options *);
+static int	filesformat(struct files *, struct context *, struct simple *,
+    const struct options *);
+static int	fileformat(struct file *, struct context *, struct simple *,
+    const struct options *);
+static int	filediff(const struct buffer *, const struct rope *,
     const struct file *);
-static int	filewrite(const struct buffer *, const struct buffer *,
+static int	filewrite(const struct buffer *, const struct rope *,
     const struct file *);
-static int	fileprint(const struct buffer *);
+static int	fileprint(const struct rope *);
 static int	fileattr(const char *, int, const char *, int);
 
-static int	tmpfd(const char *, size_t, char *, size_t);
+static int	tmpfd(const struct rope *, char *, size_t);
 
 int
 main(int argc, char *argv[])
 {
+	VECTOR(struct diffchunk) lines;
+	struct context cx = {0};
 	struct files files;
 	struct options op;
-	struct clang *cl = NULL;
 	struct simple *si = NULL;
-	struct style *st = NULL;
 	const char *clang_format = NULL;
-	size_t i;
+	int diffstdin = 0;
 	int error = 0;
 	int ch;
 
@@ -57,14 +79,17 @@ main(int argc, char *argv[])
 		err(1, "pledge");
 
 	options_init(&op);
+	if (VECTOR_INIT(lines))
+		err(1, NULL);
 
-	while ((ch = getopt(argc, argv, "c:Ddist:")) != -1) {
+	while ((ch = getopt(argc, argv, "c:Ddij:L:m:rst:w")) != -1) {
 		switch (ch) {
 		case 'c':
 			clang_format = optarg;
 			break;
 		case 'D':
 			op.diffparse = 1;
+			diffstdin = 1;
 			break;
 		case 'd':
 			op.diff = 1;
@@ -72,6 +97,53 @@ main(int argc, char *argv[])
 		case 'i':
 			op.inplace = 1;
 			break;
+		case 'j': {
+			char *end;
+			long n;
+
+			errno = 0;
+			n = strtol(optarg, &end, 10);
+			if (errno || end == optarg || *end != '\0' || n <= 0 ||
+			    n > 256) {
+				warnx("%s: invalid number of jobs", optarg);
+				VECTOR_FREE(lines);
+				return 1;
+			}
+			op.op_jobs = (unsigned int)n;
+			break;
+		}
+		case 'L': {
+			struct diffchunk *du;
+
+			du = VECTOR_CALLOC(lines);
+			if (du == NULL)
+				err(1, NULL);
+			if (diff_parse_range(optarg, du)) {
+				VECTOR_FREE(lines);
+				return 1;
+			}
+			/* Only format the given lines, as if they were changed. */
+			op.diffparse = 1;
+			break;
+		}
+		case 'm': {
+			char *end;
+			long n;
+
+			errno = 0;
+			n = strtol(optarg, &end, 10);
+			if (errno || end == optarg || *end != '\0' || n <= 0 ||
+			    (unsigned long)n > SIZE_MAX >> 20) {
+				warnx("%s: invalid memory limit", optarg);
+				VECTOR_FREE(lines);
+				return 1;
+			}
+			op.op_memlimit = (size_t)n << 20;
+			break;
+		}
+		case 'r':
+			op.recover = 1;
+			break;
 		case 's':
 			op.simple = 1;
 			break;
@@ -79,14 +151,19 @@ main(int argc, char *argv[])
 			if (options_trace_parse(&op, optarg))
 				return 1;
 			break;
+		case 'w':
+			op.watch = 1;
+			break;
 		default:
 			usage();
 		}
 	}
 	argc -= optind;
 	argv += optind;
-	if ((op.diffparse && argc > 0) ||
-	    (op.inplace && argc == 0))
+	if ((op.diffparse && VECTOR_EMPTY(lines) && argc > 0) ||
+	    (diffstdin && !VECTOR_EMPTY(lines)) ||
+	    (op.inplace && argc == 0) ||
+	    (op.watch && (op.diffparse || argc == 0)))
 		usage();
 
 	if (op.diff) {
@@ -102,6 +179,7 @@ main(int argc, char *argv[])
 
 	if (op.diffparse)
 		diff_init();
+	profile_init(&op);
 	clang_init();
 	expr_init();
 	style_init();
@@ -109,36 +187,38 @@ main(int argc, char *argv[])
 		error = 1;
 		goto out;
 	}
-	st = style_parse(clang_format, &op);
-	if (st == NULL) {
-		error = 1;
-		goto out;
-	}
+	cx.cx_sc = style_cache_alloc(clang_format, &op);
 	si = simple_alloc(&op);
-	cl = clang_alloc(st, si, &op);
+	cx.cx_src = profile_buffer_alloc(PROFILE_SOURCE, 1 << 13);
+	if (cx.cx_src == NULL)
+		err(1, NULL);
 
-	if (filelist(argc, argv, &files, &op)) {
-		error = 1;
+	if (op.watch) {
+		error = filewatch(argc, argv, &cx, clang_format, si, &op);
 		goto out;
 	}
-	for (i = 0; i < VECTOR_LENGTH(files.fs_vc); i++) {
-		struct file *fe = &files.fs_vc[i];
-
-		if (fileformat(fe, st, si, cl, &op))
-			error = 1;
-		file_close(fe);
+	if (filelist(argc, argv, &files, lines, &op)) {
+		error = 1;
+		goto out;
 	}
+	if (filesformat(&files, &cx, si, &op))
+		error = 1;
 
 out:
+	parser_free(cx.cx_pr);
+	lexer_free(cx.cx_lx);
+	buffer_free(cx.cx_src);
 	files_free(&files);
-	clang_free(cl);
+	clang_free(cx.cx_cl);
 	simple_free(si);
-	style_free(st);
+	style_cache_free(cx.cx_sc);
 	style_shutdown();
-	expr_shutdown();
 	clang_shutdown();
+	profile_shutdown();
+	tracelog_shutdown();
 	if (op.diffparse)
 		diff_shutdown();
+	VECTOR_FREE(lines);
 
 	return error;
 }
@@ -146,106 +226,221 @@ out:
 static void
 usage(void)
 {
-	fprintf(stderr, "usage: knfmt [-Ddis] [file ...]\n");
+	fprintf(stderr, "usage: knfmt [-Ddirsw] [-j jobs] [-L start:end] "
+	    "[-m megabytes] [file ...]\n");
 	exit(1);
 }
 
 static int
 filelist(int argc, char **argv, struct files *files,
-    const struct options *op)
+    const struct diffchunk *lines, const struct options *op)
 {
-	if (op->diffparse)
+	size_t i;
+
+	if (op->diffparse && VECTOR_EMPTY(lines))
 		return diff_parse(files, op);
 
 	if (argc == 0) {
 		files_alloc(files, "/dev/stdin");
 	} else {
-		int i;
+		int j;
 
-		for (i = 0; i < argc; i++)
-			files_alloc(files, argv[i]);
+		for (j = 0; j < argc; j++)
+			files_alloc(files, argv[j]);
+	}
+
+	for (i = 0; i < VECTOR_LENGTH(files->fs_vc); i++) {
+		struct file *fe = &files->fs_vc[i];
+		size_t j;
+
+		for (j = 0; j < VECTOR_LENGTH(lines); j++) {
+			struct diffchunk *du;
+
+			du = VECTOR_ALLOC(fe->fe_diff);
+			if (du == NULL)
+				err(1, NULL);
+			*du = lines[j];
+		}
 	}
 	return 0;
 }
 
+/*
+ * Format the files changed under the given paths until interrupted, keeping
+ * all state across changes. The styles are only parsed again once any
+ * .clang-format file in a watched directory changes.
+ */
+static int
+filewatch(int argc, char **argv, struct context *cx, const char *clang_format,
+    struct simple *si, const struct options *op)
+{
+	struct watch *wa;
+	int error = 0;
+	int i;
+
+	wa = watch_alloc();
+	if (wa == NULL)
+		return 1;
+	for (i = 0; i < argc; i++) {
+		if (watch_add(wa, argv[i])) {
+			error = 1;
+			goto out;
+		}
+	}
+
+	for (;;) {
+		struct files files;
+		int restyle = 0;
+
+		if (VECTOR_INIT(files.fs_vc))
+			err(1, NULL);
+		if (watch_wait(wa, &files, &restyle)) {
+			files_free(&files);
+			error = 1;
+			break;
+		}
+		if (restyle) {
+			style_cache_free(cx->cx_sc);
+			cx->cx_sc = style_cache_alloc(clang_format, op);
+			cx->cx_st = NULL;
+			clang_free(cx->cx_cl);
+			cx->cx_cl = NULL;
+		}
+		(void)filesformat(&files, cx, si, op);
+		files_free(&files);
+	}
+
+out:
+	watch_free(wa);
+	return error;
+}
+
+static int
+filesformat(struct files *files, struct context *cx, struct simple *si,
+    const struct options *op)
+{
+	size_t i;
+	int error = 0;
+
+	for (i = 0; i < VECTOR_LENGTH(files->fs_vc); i++) {
+		struct file *fe = &files->fs_vc[i];
+		const struct style *st;
+		const char *path = fe->fe_path;
+
+		/* Standard input is relative to the current directory. */
+		if (strcmp(path, "/dev/stdin") == 0)
+			path = NULL;
+		st = style_cache_get(cx->cx_sc, path);
+		if (st != cx->cx_st) {
+			cx->cx_st = st;
+			clang_free(cx->cx_cl);
+			cx->cx_cl = clang_alloc(st, si, op);
+		}
+		if (fileformat(fe, cx, si, op))
+			error = 1;
+		file_close(fe);
+	}
+	return error;
+}
+
 static int
-fileformat(struct file *fe, const struct style *st, struct simple *si,
-    struct clang *cl, const struct options *op)
+fileformat(struct file *fe, struct context *cx, struct simple *si,
+    const struct options *op)
 {
-	struct buffer *dst = NULL;
-	struct buffer *src;
+	struct lexer_arg arg = {
+		.path		= fe->fe_path,
+		.bf		= cx->cx_src,
+		.diff		= fe->fe_diff,
+		.op		= op,
+		.error_flush	= trace(op, 'l') > 0,
+		.callbacks	= {
+			.read		= clang_read,
+			.alloc		= token_alloc,
+			.serialize	= token_serialize,
+			.arg		= cx->cx_cl,
+		},
+	};
+	const struct style *st = cx->cx_st;
+	const struct buffer *src = cx->cx_src;
+	struct rope *split = NULL;
+	struct rope *dst = NULL;
 	struct lexer *lx = NULL;
-	struct parser *pr = NULL;
+	int recovered = 0;
 	int error = 0;
 
-	src = file_read(fe);
-	if (src == NULL) {
+	/* Storage reused from previous files is exempt from any memory limit. */
+	profile_limit_reset();
+	if (file_read(fe, cx->cx_src)) {
 		error = 1;
 		goto out;
 	}
-	lx = lexer_alloc(&(const struct lexer_arg){
-	    .path	= fe->fe_path,
-	    .bf		= src,
-	    .diff	= fe->fe_diff,
-	    .op		= op,
-	    .error_flush= trace(op, 'l') > 0,
-	    .callbacks	= {
-		.read		= clang_read,
-		.alloc		= token_alloc,
-		.serialize	= token_serialize,
-		.arg		= cl,
-	    },
-	});
-	if (lx == NULL) {
-		error = 1;
-		goto out;
+	split = split_exec(src, fe->fe_path, st, op);
+	if (split != NULL) {
+		dst = split;
+		goto write;
 	}
-	pr = parser_alloc(lx, st, si, op);
-	if (pr == NULL) {
+
+	if (cx->cx_lx == NULL) {
+		cx->cx_lx = lexer_alloc(&arg);
+		if (cx->cx_lx == NULL) {
+			error = 1;
+			goto out;
+		}
+	} else if (lexer_recycle(cx->cx_lx, &arg)) {
 		error = 1;
 		goto out;
 	}
-	dst = parser_exec(pr, fe->fe_diff, buffer_get_len(src));
+	lx = cx->cx_lx;
+	if (cx->cx_pr == NULL)
+		cx->cx_pr = parser_alloc(lx, st, si, op);
+	else
+		parser_recycle(cx->cx_pr, st);
+	dst = parser_exec(cx->cx_pr, fe->fe_diff, src);
+	profile_cost_report(fe->fe_path);
 	if (dst == NULL) {
 		error = 1;
 		goto out;
 	}
+	/* The file is still written but the parse error must not go unnoticed. */
+	recovered = parser_get_recovered(cx->cx_pr) > 0;
 
+write:
 	if (op->diff)
 		error = filediff(src, dst, fe);
 	else if (op->inplace)
 		error = filewrite(src, dst, fe);
 	else
 		error = fileprint(dst);
+	if (recovered)
+		error = 1;
 
 out:
 	if (lx != NULL && error)
 		lexer_error_flush(lx);
-	buffer_free(dst);
-	parser_free(pr);
-	lexer_free(lx);
-	buffer_free(src);
+	rope_free(split);
 	return error;
 }
 
 static int
-filediff(const struct buffer *src, const struct buffer *dst,
+filediff(const struct buffer *src, const struct rope *dst,
     const struct file *fe)
 {
 	char dstpath[PATH_MAX], srcpath[PATH_MAX];
+	struct rope *rp;
 	pid_t pid;
 	int dstfd = -1;
 	int srcfd = -1;
 
-	if (buffer_cmp(src, dst) == 0)
+	if (rope_cmp(dst, src) == 0)
 		return 0;
 
-	srcfd = tmpfd(buffer_get_ptr(src), buffer_get_len(src),
-	    srcpath, sizeof(srcpath));
+	rp = rope_alloc(src);
+	rope_puts(rp, buffer_get_ptr(src), buffer_get_len(src));
+	srcfd = tmpfd(rp, srcpath, sizeof(srcpath));
+	rope_free(rp);
 	if (srcfd == -1)
 		goto out;
-	dstfd = tmpfd(buffer_get_ptr(dst), buffer_get_len(dst),
-	    dstpath, sizeof(dstpath));
+	dstfd = tmpfd(dst, dstpath, sizeof(dstpath));
 	if (dstfd == -1)
 		goto out;
 
@@ -283,16 +478,14 @@ out:
 }
 
 static int
-filewrite(const struct buffer *src, const struct buffer *dst,
+filewrite(const struct buffer *src, const struct rope *dst,
     const struct file *fe)
 {
-	const char *buf;
 	char *tmppath;
-	size_t buflen;
 	mode_t old_umask;
 	int fd;
 
-	if (buffer_cmp(src, dst) == 0)
+	if (rope_cmp(dst, src) == 0)
 		return 0;
 
 	tmppath = tmptemplate(fe->fe_path);
@@ -304,18 +497,9 @@ filewrite(const struct buffer *src, const struct buffer *dst,
 		goto err;
 	}
 
-	buf = buffer_get_ptr(dst);
-	buflen = buffer_get_len(dst);
-	while (buflen > 0) {
-		ssize_t nw;
-
-		nw = write(fd, buf, buflen);
-		if (nw == -1) {
-			warn("write: %s", tmppath);
-			goto err;
-		}
-		buf += nw;
-		buflen -= (size_t)nw;
+	if (rope_write(dst, fd)) {
+		warn("write: %s", tmppath);
+		goto err;
 	}
 
 	if (fileattr(tmppath, fd, fe->fe_path, fe->fe_fd))
@@ -344,21 +528,11 @@ err:
 }
 
 static int
-fileprint(const struct buffer *dst)
+fileprint(const struct rope *dst)
 {
-	const char *buf = buffer_get_ptr(dst);
-	size_t buflen = buffer_get_len(dst);
-
-	while (buflen > 0) {
-		ssize_t nw;
-
-		nw = write(1, buf, buflen);
-		if (nw == -1) {
-			warn("write: /dev/stdout");
-			return 1;
-		}
-		buflen -= (size_t)nw;
-		buf += nw;
+	if (rope_write(dst, 1)) {
+		warn("write: /dev/stdout");
+		return 1;
 	}
 	return 0;
 }
@@ -393,11 +567,11 @@ fileattr(const char *srcpath, int srcfd, const char *dstpath, int dstfd)
 
 /*
  * Get a read/write file descriptor by creating a temporary file and write out
- * the given buffer. The file is immediately removed in the hopes of returning
+ * the given rope. The file is immediately removed in the hopes of returning
  * the last reference to the file.
  */
 static int
-tmpfd(const char *buf, size_t buflen, char *path, size_t pathsiz)
+tmpfd(const struct rope *rp, char *path, size_t pathsiz)
 {
 	char tmppath[PATH_MAX];
 	size_t siz = sizeof(tmppath);
@@ -422,16 +596,9 @@ tmpfd(const char *buf, size_t buflen, char *path, size_t pathsiz)
 		goto err;
 	}
 
-	while (buflen > 0) {
-		ssize_t nw;
-
-		nw = write(fd, buf, buflen);
-		if (nw == -1) {
-			warn("write");
-			goto err;
-		}
-		buf += nw;
-		buflen -= (size_t)nw;
+	if (rope_write(rp, fd)) {
+		warn("write");
+		goto err;
 	}
 	if (lseek(fd, 0, SEEK_SET) == -1) {
 		warn("lseek");
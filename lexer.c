@@ -17,7 +17,9 @@
 #include "diff.h"
 #include "error.h"
 #include "options.h"
+#include "profile.h"
 #include "token.h"
+#include "tracelog.h"
 #include "util.h"
 
 #ifdef HAVE_QUEUE
@@ -26,6 +28,9 @@
 #  include "compat-queue.h"
 #endif
 
+/* Number of serialized tokens kept alive, see lexer_serialize(). */
+#define LEXER_SERIALIZE_SLOTS	8
+
 struct lexer {
 	struct lexer_state	 lx_st;
 	struct lexer_callbacks	 lx_callbacks;
@@ -34,6 +39,8 @@ struct lexer {
 	const struct diffchunk	*lx_diff;
 	const struct buffer	*lx_bf;
 	const char		*lx_path;
+	/* Record traces in the binary event log, see lexer_trace(). */
+	int			 lx_tracelog;
 
 	/* Line number to buffer offset mapping. */
 	VECTOR(size_t)		 lx_lines;
@@ -48,14 +55,48 @@ struct lexer {
 
 	struct token_list	 lx_tokens;
 	VECTOR(struct token *)	 lx_stamps;
-	VECTOR(char *)		 lx_serialized;
+	/* Ring of serialized tokens, see lexer_serialize(). */
+	struct {
+		char		*slots[LEXER_SERIALIZE_SLOTS];
+		unsigned int	 next;
+	} lx_serialized;
+};
+
+/* Difference between the buffer before and after an edit. */
+struct lexer_delta {
+	const char	*ld_old;
+	const char	*ld_new;
+	size_t		 ld_rmlen;
+	size_t		 ld_inslen;
+	unsigned int	 ld_rmlines;
+	unsigned int	 ld_inslines;
 };
 
-static void	lexer_line_alloc(struct lexer *, unsigned int);
+static int		 lexer_exec(struct lexer *, const struct lexer_arg *);
+static int		 lexer_exec_copy(struct lexer *, const struct lexer *);
+static struct token	*lexer_read(struct lexer *, struct token_list *);
+static void		 lexer_discard(struct lexer *, struct token *);
+static void		 lexer_release(struct lexer *);
+static void		 lexer_line_alloc(struct lexer *, unsigned int);
+static void		 lexer_line_edit(struct lexer *, size_t,
+    struct lexer_delta *);
+
+static struct token	*lexer_copy_token(struct lexer *,
+    const struct token *);
+static void		 lexer_shift(const struct lexer *, struct token *,
+    const struct lexer_delta *);
+static void		 lexer_shift0(const struct lexer *, struct token *,
+    const struct lexer_delta *);
+static int		 lexer_resync(const struct token *,
+    const struct lexer_delta *, size_t, size_t);
+
+static const struct token	*lexer_token_first(const struct token *);
 
 static void	lexer_expect_error(struct lexer *, int, const struct token *,
     const char *, int);
 
+static int	lexer_branch_take(struct lexer *);
+static void	lexer_branch_rewind(struct lexer *, struct token *);
 static void	lexer_branch_fold(struct lexer *, struct token *);
 static void	lexer_branch_unmute(struct lexer *, struct token *);
 
@@ -65,6 +106,10 @@ static void	lexer_branch_unmute(struct lexer *, struct token *);
 
 static struct token	*lexer_recover_branch(struct token *);
 static struct token	*lexer_recover_branch1(struct token *, unsigned int);
+static struct token	*lexer_decl_span(struct token *,
+    const struct token *, struct token **);
+static int		 lexer_decl_is_unchanged(const struct token *,
+    const struct token *);
 
 static void	lexer_reposition_tokens(struct lexer *, struct token *);
 
@@ -74,26 +119,21 @@ static int	lexer_peek_until_not_nested(struct lexer *, int,
 static const struct diffchunk	*lexer_get_diffchunk(const struct lexer *,
     unsigned int);
 
-#define lexer_trace(lx, fmt, ...) do {					\
+#define lexer_trace(lx, ev, ...) do {					\
 	if (trace((lx)->lx_op, 'l'))					\
-		tracef('L', __func__, (fmt), __VA_ARGS__);		\
+		lexer_trace0((lx), (ev), __VA_ARGS__);			\
 } while (0)
+static void		 lexer_trace0(struct lexer *, enum tracelog_event,
+    ...);
+static const char	*lexer_trace_serialize(void *, const struct token *);
 
 struct lexer *
 lexer_alloc(const struct lexer_arg *arg)
 {
-	VECTOR(struct token *) discarded;
 	struct lexer *lx;
 
 	lx = ecalloc(1, sizeof(*lx));
-	lx->lx_callbacks = arg->callbacks;
 	lx->lx_er = error_alloc(arg->error_flush);
-	lx->lx_op = arg->op;
-	lx->lx_bf = arg->bf;
-	lx->lx_diff = arg->diff;
-	lx->lx_path = arg->path;
-	lx->lx_st.st_lno = 1;
-	lx->lx_st.st_cno = 1;
 	if (VECTOR_INIT(lx->lx_lines))
 		err(1, NULL);
 	if (VECTOR_INIT(lx->lx_columns))
@@ -101,88 +141,189 @@ lexer_alloc(const struct lexer_arg *arg)
 	TAILQ_INIT(&lx->lx_tokens);
 	if (VECTOR_INIT(lx->lx_stamps))
 		err(1, NULL);
-	if (VECTOR_INIT(lx->lx_serialized))
-		err(1, NULL);
-	lexer_line_alloc(lx, 1);
+	if (lexer_exec(lx, arg)) {
+		lexer_free(lx);
+		return NULL;
+	}
+	return lx;
+}
 
-	if (VECTOR_INIT(discarded))
-		err(1, NULL);
+/*
+ * Reuse the lexer for another buffer, retaining allocations grown while lexing
+ * previous buffers. Reporting of errors is still governed by the arguments
+ * given to lexer_alloc(). Returns non-zero on error, the lexer can however
+ * still be recycled again.
+ */
+int
+lexer_recycle(struct lexer *lx, const struct lexer_arg *arg)
+{
+	lexer_release(lx);
+	error_reset(lx->lx_er);
+	profile_free(PROFILE_SOURCE,
+	    VECTOR_LENGTH(lx->lx_lines) * sizeof(*lx->lx_lines));
+	VECTOR_CLEAR(lx->lx_lines);
+	VECTOR_CLEAR(lx->lx_columns);
+	memset(&lx->lx_st, 0, sizeof(lx->lx_st));
+	lx->lx_eof = 0;
+	lx->lx_peek = 0;
+	return lexer_exec(lx, arg);
+}
 
-	for (;;) {
-		struct token *tk;
+/*
+ * Replace the given number of bytes at the given offset in the buffer with the
+ * given number of bytes, the given buffer holding the result of the edit. Only
+ * the lines affected by the edit are lexed again, all other tokens are retained
+ * and shifted. All tokens are flagged using the given diff chunks, which must
+ * already account for the edit. Returns non-zero on error, the lexer can then
+ * only be recycled.
+ */
+int
+lexer_edit(struct lexer *lx, const struct buffer *bf, struct diffchunk *diff,
+    size_t off, size_t rmlen, size_t inslen)
+{
+	struct lexer_delta ld = {
+		.ld_old		= buffer_get_ptr(lx->lx_bf),
+		.ld_new		= buffer_get_ptr(bf),
+		.ld_rmlen	= rmlen,
+		.ld_inslen	= inslen,
+	};
+	struct lexer_delta keep = {
+		.ld_old		= ld.ld_old,
+		.ld_new		= ld.ld_new,
+	};
+	struct lexer_state oldst;
+	struct token_list tokens;
+	struct token *beg, *end, *last, *nx, *pv, *tk;
+	int oldeof;
 
-		tk = lx->lx_callbacks.read(lx, lx->lx_callbacks.arg);
-		if (tk == NULL)
-			goto err;
-		TAILQ_INSERT_TAIL(&lx->lx_tokens, tk, tk_entry);
-		if (tk->tk_flags & TOKEN_FLAG_DISCARD) {
-			struct token **dst;
+	lx->lx_bf = bf;
+	lx->lx_diff = diff;
 
-			/* Discarded tokens must leave the column intact. */
-			lx->lx_st.st_cno -= strwidth(tk->tk_str, tk->tk_len, 0);
-			if (lx->lx_st.st_cno == 0)
-				lx->lx_st.st_cno = 1;
+	/*
+	 * Find the last token preceding the edit from which reading can
+	 * resume, falling back to the first token. Reading a token peeks at the
+	 * first byte of the next token which must therefore also precede the
+	 * edit.
+	 */
+	beg = TAILQ_FIRST(&lx->lx_tokens);
+	for (tk = beg; tk->tk_type != LEXER_EOF; tk = nx) {
+		nx = token_next(tk);
+		if (lexer_token_first(nx)->tk_off >= off)
+			break;
+		if ((tk->tk_flags & TOKEN_FLAG_RESUME) &&
+		    nx->tk_type != LEXER_EOF)
+			beg = nx;
+	}
 
-			dst = VECTOR_ALLOC(discarded);
-			if (dst == NULL)
-				err(1, NULL);
-			*dst = tk;
+	oldst = lx->lx_st;
+	oldeof = lx->lx_eof;
+	memset(&lx->lx_st, 0, sizeof(lx->lx_st));
+	if (beg == TAILQ_FIRST(&lx->lx_tokens)) {
+		lx->lx_st.st_lno = 1;
+	} else {
+		lx->lx_st.st_lno = lexer_token_first(beg)->tk_lno;
+		lx->lx_st.st_off = lx->lx_lines[lx->lx_st.st_lno - 1];
+	}
+	lx->lx_st.st_cno = 1;
+	lx->lx_eof = 0;
+	VECTOR_CLEAR(lx->lx_columns);
+	lexer_line_edit(lx, off, &ld);
+
+	/*
+	 * Read until ending up on the same line as one of the old tokens
+	 * following the edit, from which point the old tokens are identical
+	 * except for their position.
+	 */
+	TAILQ_INIT(&tokens);
+	end = beg;
+	for (;;) {
+		tk = lexer_read(lx, &tokens);
+		if (tk == NULL)
+			goto err;
+		if (tk->tk_type == LEXER_EOF) {
+			end = NULL;
+			break;
 		}
-		if (tk->tk_type == LEXER_EOF)
+		if ((tk->tk_flags & (TOKEN_FLAG_RESUME | TOKEN_FLAG_DISCARD)) !=
+		    TOKEN_FLAG_RESUME)
+			continue;
+
+		while (end->tk_type != LEXER_EOF &&
+		    (lexer_token_first(end)->tk_off < off + rmlen ||
+		     lexer_token_first(end)->tk_off - rmlen + inslen <
+		     lx->lx_st.st_off))
+			end = token_next(end);
+		if (lexer_resync(end, &ld, off, lx->lx_st.st_off))
 			break;
 	}
 
-	while (!VECTOR_EMPTY(discarded)) {
-		struct token **tail;
-
-		tail = VECTOR_POP(discarded);
-		lexer_remove(lx, *tail, 1);
+	/* Replace the old tokens. */
+	pv = token_prev(beg);
+	for (tk = beg; tk != end; tk = nx) {
+		nx = token_next(tk);
+		assert(tk->tk_refs == 1);
+		token_list_remove(&lx->lx_tokens, tk);
+	}
+	last = TAILQ_LAST(&tokens, token_list);
+	while ((tk = TAILQ_FIRST(&tokens)) != NULL) {
+		TAILQ_REMOVE(&tokens, tk, tk_entry);
+		if (end != NULL)
+			TAILQ_INSERT_BEFORE(end, tk, tk_entry);
+		else
+			TAILQ_INSERT_TAIL(&lx->lx_tokens, tk, tk_entry);
 	}
-	VECTOR_FREE(discarded);
 
-	if (trace(lx->lx_op, 't'))
-		lexer_dump(lx);
+	/* Move the remaining tokens to the new buffer. */
+	for (tk = pv != NULL ? TAILQ_FIRST(&lx->lx_tokens) : NULL; tk != NULL;
+	    tk = token_next(tk)) {
+		lexer_shift(lx, tk, &keep);
+		if (tk == pv)
+			break;
+	}
+	for (tk = end; tk != NULL; tk = token_next(tk))
+		lexer_shift(lx, tk, &ld);
+
+	/* Remove discarded tokens, the same way as lexer_exec(). */
+	for (tk = last; tk != pv; tk = nx) {
+		nx = token_prev(tk);
+		if (tk->tk_flags & TOKEN_FLAG_DISCARD)
+			lexer_discard(lx, tk);
+	}
 
-	return lx;
+	if (end != NULL) {
+		/* The remaining tokens have already been read. */
+		lx->lx_st = oldst;
+		lx->lx_st.st_off = oldst.st_off - rmlen + inslen;
+		lx->lx_st.st_lno = oldst.st_lno - ld.ld_rmlines +
+		    ld.ld_inslines;
+		lx->lx_eof = oldeof;
+	}
+	lx->lx_st.st_tk = NULL;
+	return 0;
 
 err:
-	VECTOR_FREE(discarded);
-	lexer_free(lx);
-	return NULL;
+	while ((tk = TAILQ_FIRST(&tokens)) != NULL)
+		token_list_remove(&tokens, tk);
+	return 1;
 }
 
 void
 lexer_free(struct lexer *lx)
 {
-	struct token *tk;
+	size_t i;
 
 	if (lx == NULL)
 		return;
 
+	lexer_release(lx);
 	error_free(lx->lx_er);
+	profile_free(PROFILE_SOURCE,
+	    VECTOR_LENGTH(lx->lx_lines) * sizeof(*lx->lx_lines));
 	VECTOR_FREE(lx->lx_lines);
 	VECTOR_FREE(lx->lx_columns);
-	if (lx->lx_unmute != NULL)
-		token_rele(lx->lx_unmute);
-	while (!VECTOR_EMPTY(lx->lx_stamps)) {
-		struct token **tail;
-
-		tail = VECTOR_POP(lx->lx_stamps);
-		token_rele(*tail);
-	}
 	VECTOR_FREE(lx->lx_stamps);
-	while ((tk = TAILQ_FIRST(&lx->lx_tokens)) != NULL) {
-		TAILQ_REMOVE(&lx->lx_tokens, tk, tk_entry);
-		assert(tk->tk_refs == 1);
-		token_rele(tk);
-	}
-	while (!VECTOR_EMPTY(lx->lx_serialized)) {
-		char **tail;
-
-		tail = VECTOR_POP(lx->lx_serialized);
-		free(*tail);
-	}
-	VECTOR_FREE(lx->lx_serialized);
+	for (i = 0; i < LEXER_SERIALIZE_SLOTS; i++)
+		free(lx->lx_serialized.slots[i]);
 	free(lx);
 }
 
@@ -345,10 +486,10 @@ lexer_error(struct lexer *lx, const struct token *ctx, const char *fun, int lno,
 	error_end(lx->lx_er);
 }
 
-void
+int
 lexer_error_flush(struct lexer *lx)
 {
-	error_flush(lx->lx_er, 1);
+	return error_flush(lx->lx_er, 1);
 }
 
 void
@@ -359,8 +500,9 @@ lexer_error_reset(struct lexer *lx)
 }
 
 /*
- * Serialize the given token. The returned string will be freed once
- * lexer_free() is invoked.
+ * Serialize the given token. The returned string is only valid until
+ * lexer_serialize() has been invoked LEXER_SERIALIZE_SLOTS more times, keeping
+ * the memory usage bounded while tracing.
  */
 const char *
 lexer_serialize(struct lexer *lx, const struct token *tk)
@@ -370,9 +512,10 @@ lexer_serialize(struct lexer *lx, const struct token *tk)
 	if (tk == NULL)
 		return "(null)";
 
-	str = VECTOR_ALLOC(lx->lx_serialized);
-	if (str == NULL)
-		err(1, NULL);
+	str = &lx->lx_serialized.slots[lx->lx_serialized.next];
+	lx->lx_serialized.next =
+	    (lx->lx_serialized.next + 1) % LEXER_SERIALIZE_SLOTS;
+	free(*str);
 	*str = lx->lx_callbacks.serialize(tk);
 	if (*str == NULL)
 		err(1, NULL);
@@ -424,13 +567,14 @@ lexer_stamp(struct lexer *lx)
 	if (tk->tk_flags & TOKEN_FLAG_STAMP)
 		return;
 
-	lexer_trace(lx, "stamp %s", lexer_serialize(lx, tk));
+	lexer_trace(lx, TRACELOG_LEXER_STAMP, tk);
 	tk->tk_flags |= TOKEN_FLAG_STAMP;
 	token_ref(tk);
 	dst = VECTOR_ALLOC(lx->lx_stamps);
 	if (dst == NULL)
 		err(1, NULL);
 	*dst = tk;
+	profile_alloc(PROFILE_TOKEN, "STAMP", NULL, 0, sizeof(*dst));
 }
 
 /*
@@ -449,18 +593,16 @@ lexer_recover(struct lexer *lx)
 
 	if (!lexer_back(lx, &back))
 		back = TAILQ_FIRST(&lx->lx_tokens);
-	lexer_trace(lx, "back %s", lexer_serialize(lx, back));
+	lexer_trace(lx, TRACELOG_LEXER_RECOVER_BACK, back);
 	br = lexer_recover_branch(back);
 	if (br == NULL)
 		return 0;
+	profile_cost(PROFILE_COST_RECOVER, br->tk_lno, 1);
 
 	src = br->tk_branch.br_parent;
 	dst = br->tk_branch.br_nx->tk_branch.br_parent;
-	lexer_trace(lx, "branch from %s to %s covering [%s, %s)",
-	    lexer_serialize(lx, br),
-	    lexer_serialize(lx, br->tk_branch.br_nx),
-	    lexer_serialize(lx, src),
-	    lexer_serialize(lx, dst));
+	lexer_trace(lx, TRACELOG_LEXER_RECOVER_BRANCH,
+	    br, br->tk_branch.br_nx, src, dst);
 
 	/*
 	 * Find the offset of the first stamped token before the branch.
@@ -493,71 +635,151 @@ lexer_recover(struct lexer *lx)
 	}
 	token_rele(br);
 
-	lexer_trace(lx, "seek to %s, removing %d document(s)",
-	    lexer_serialize(lx, seek ? seek : TAILQ_FIRST(&lx->lx_tokens)),
-	    ndocs);
+	lexer_trace(lx, TRACELOG_LEXER_RECOVER_SEEK,
+	    seek ? seek : TAILQ_FIRST(&lx->lx_tokens), ndocs);
 	lx->lx_st.st_tk = seek;
 	lx->lx_st.st_err = 0;
 	return ndocs;
 }
 
 /*
- * Returns non-zero if the lexer took the next branch.
+ * Last resort while trying to recover after encountering invalid source code,
+ * turn the failing top level declaration into a verbatim prefix of the token
+ * following it. Returns non-zero if the declaration was folded, the caller is
+ * then expected to discard all documents emitted since the last stamped token
+ * as everything up to the folded declaration must be parsed again.
  */
 int
-lexer_branch(struct lexer *lx)
+lexer_recover_verbatim(struct lexer *lx)
 {
-	struct token **last;
-	struct token *br, *dst, *rm, *seek, *tk;
+	const char *buf = buffer_get_ptr(lx->lx_bf);
+	struct token *end = NULL;
+	struct token *back, *dst, *prefix, *rm, *seek, *start;
+	size_t len, off;
+	int unmute = 0;
 
-	if (!lexer_back(lx, &tk))
+	seek = VECTOR_EMPTY(lx->lx_stamps) ? NULL : *VECTOR_LAST(lx->lx_stamps);
+	start = seek != NULL ? token_next(seek) : TAILQ_FIRST(&lx->lx_tokens);
+	if (start == NULL || start->tk_type == LEXER_EOF)
 		return 0;
-	br = token_get_branch(tk);
-	if (br == NULL)
+	if (!lexer_back(lx, &back) || back == seek)
+		back = start;
+	start = lexer_decl_span(start, back, &end);
+	if (start == NULL)
 		return 0;
+	dst = token_next(end);
 
-	dst = br->tk_branch.br_nx->tk_branch.br_parent;
-
-	lexer_trace(lx, "branch from %s to %s, covering [%s, %s)",
-	    lexer_serialize(lx, br),
-	    lexer_serialize(lx, br->tk_branch.br_nx),
-	    lexer_serialize(lx, br->tk_branch.br_parent),
-	    lexer_serialize(lx, br->tk_branch.br_nx->tk_branch.br_parent));
+	/*
+	 * Cover everything up to the destination, including any blank line(s)
+	 * but not the indentation of the destination.
+	 */
+	off = TAILQ_EMPTY(&start->tk_prefixes) ?
+	    start->tk_off : TAILQ_FIRST(&start->tk_prefixes)->tk_off;
+	len = (TAILQ_EMPTY(&dst->tk_prefixes) ?
+	    dst->tk_off : TAILQ_FIRST(&dst->tk_prefixes)->tk_off) - off;
+	while (len > 0 && (buf[off + len - 1] == ' ' ||
+	    buf[off + len - 1] == '\t'))
+		len--;
+	profile_cost(PROFILE_COST_RECOVER, start->tk_lno, 1);
 
-	token_branch_unlink(br);
+	prefix = lx->lx_callbacks.alloc(&(struct token){
+	    .tk_type	= TOKEN_CPP,
+	    .tk_flags	= TOKEN_FLAG_CPP,
+	});
+	prefix->tk_lno = start->tk_lno;
+	prefix->tk_cno = start->tk_cno;
+	prefix->tk_off = off;
+	prefix->tk_str = &buf[off];
+	prefix->tk_len = len;
+	lexer_trace(lx, TRACELOG_LEXER_RECOVER_PREFIX, prefix, dst);
+	TAILQ_INSERT_HEAD(&dst->tk_prefixes, prefix, tk_entry);
 
-	rm = br->tk_branch.br_parent;
-	for (;;) {
+	for (rm = start; rm != dst;) {
 		struct token *nx;
 
-		lexer_trace(lx, "removing %s", lexer_serialize(lx, rm));
-
 		nx = token_next(rm);
+		lexer_trace(lx, TRACELOG_LEXER_RECOVER_REMOVE, rm);
+		if (rm->tk_flags & TOKEN_FLAG_UNMUTE)
+			unmute = 1;
 		lexer_remove(lx, rm, 0);
-		if (nx == dst)
-			break;
 		rm = nx;
 	}
+	if (unmute)
+		lexer_branch_unmute(lx, dst);
 
-	/*
-	 * Tell doc_token() that crossing this token must cause tokens to be
-	 * emitted again. While here, disarm any previous unmute token as it
-	 * might be crossed again.
-	 */
-	if (lx->lx_unmute != NULL) {
-		lx->lx_unmute->tk_flags &= ~TOKEN_FLAG_UNMUTE;
-		token_rele(lx->lx_unmute);
-		lx->lx_unmute = NULL;
+	lx->lx_st.st_tk = seek;
+	lx->lx_st.st_err = 0;
+	return 1;
+}
+
+/*
+ * While only formatting changed lines, seek past all top level declarations
+ * not touched by any diff chunk as they are emitted as is. Returns non-zero if
+ * any declaration was skipped.
+ */
+int
+lexer_seek_unchanged(struct lexer *lx)
+{
+	struct token *end = NULL;
+	struct token *tk;
+
+	tk = lx->lx_st.st_tk != NULL ?
+	    token_next(lx->lx_st.st_tk) : TAILQ_FIRST(&lx->lx_tokens);
+	while (tk != NULL && tk->tk_type != LEXER_EOF) {
+		struct token *last, *px;
+
+		if (lexer_decl_span(tk, tk, &last) == NULL ||
+		    !lexer_decl_is_unchanged(tk, last))
+			break;
+		tk = token_next(last);
+		/*
+		 * Consecutive declarations are aligned as a block, only seek
+		 * past complete blocks.
+		 */
+		if (last->tk_type == TOKEN_RBRACE || token_has_line(last, 2) ||
+		    tk->tk_type == LEXER_EOF)
+			end = last;
+		TAILQ_FOREACH(px, &tk->tk_prefixes, tk_entry) {
+			if (px->tk_flags & TOKEN_FLAG_CPP)
+				end = last;
+		}
 	}
-	lexer_branch_unmute(lx, dst);
+	if (end == NULL)
+		return 0;
 
+	lexer_trace(lx, TRACELOG_LEXER_SEEK_UNCHANGED, end);
+	lx->lx_st.st_tk = end;
+	return 1;
+}
+
+/*
+ * Returns non-zero if the lexer took the next branch, rewinding to the last
+ * stamped token.
+ */
+int
+lexer_branch(struct lexer *lx)
+{
+	struct token **last;
+
+	if (!lexer_branch_take(lx))
+		return 0;
 	/* Rewind to last stamped token. */
 	last = VECTOR_LAST(lx->lx_stamps);
-	seek = last == NULL ? NULL : *last;
-	lexer_trace(lx, "seek to %s",
-	    lexer_serialize(lx, seek ? seek : TAILQ_FIRST(&lx->lx_tokens)));
-	lx->lx_st.st_tk = seek;
-	lx->lx_st.st_err = 0;
+	lexer_branch_rewind(lx, last == NULL ? NULL : *last);
+	return 1;
+}
+
+/*
+ * Returns non-zero if the lexer took the next branch, rewinding to the given
+ * token which must reside before the first token removed by the branch, see
+ * lexer_branch_start().
+ */
+int
+lexer_branch_seek(struct lexer *lx, struct token *seek)
+{
+	if (!lexer_branch_take(lx))
+		return 0;
+	lexer_branch_rewind(lx, seek);
 	return 1;
 }
 
@@ -565,7 +787,7 @@ int
 lexer_seek(struct lexer *lx, struct token *tk)
 {
 	if (lx->lx_peek == 0)
-		lexer_trace(lx, "seek to %s", lexer_serialize(lx, tk));
+		lexer_trace(lx, TRACELOG_LEXER_SEEK, tk);
 	lx->lx_st.st_tk = token_prev(tk);
 	return lx->lx_st.st_tk == NULL ? 0 : 1;
 }
@@ -590,11 +812,33 @@ lexer_is_branch(const struct lexer *lx)
 	return lexer_back(lx, &tk) && token_get_branch(tk) != NULL;
 }
 
+/*
+ * Get the first token about to be removed while taking the next branch.
+ * Returns non-zero if such token is found.
+ */
+int
+lexer_branch_start(const struct lexer *lx, struct token **tk)
+{
+	struct token *back, *br;
+
+	if (!lexer_back(lx, &back))
+		return 0;
+	br = token_get_branch(back);
+	if (br == NULL)
+		return 0;
+	*tk = br->tk_branch.br_parent;
+	return 1;
+}
+
 int
 lexer_pop(struct lexer *lx, struct token **tk)
 {
 	struct lexer_state *st = &lx->lx_st;
 
+	/* Halt the parser, see parser_exec(). */
+	if (unlikely(profile_exhausted()))
+		return 0;
+
 	if (st->st_tk == NULL) {
 		st->st_tk = TAILQ_FIRST(&lx->lx_tokens);
 	} else if (st->st_tk->tk_type != LEXER_EOF) {
@@ -613,8 +857,7 @@ lexer_pop(struct lexer *lx, struct token **tk)
 
 		if (lx->lx_peek == 0) {
 			/* While not peeking, instruct the parser to halt. */
-			lexer_trace(lx, "halt %s",
-			    lexer_serialize(lx, st->st_tk));
+			lexer_trace(lx, TRACELOG_LEXER_HALT, st->st_tk);
 			return 0;
 		} else {
 			/* While peeking, act as taking the current branch. */
@@ -625,6 +868,8 @@ lexer_pop(struct lexer *lx, struct token **tk)
 	}
 
 out:
+	if (lx->lx_peek > 0)
+		profile_cost(PROFILE_COST_PEEK, st->st_tk->tk_lno, 1);
 	*tk = st->st_tk;
 	return 1;
 }
@@ -770,6 +1015,7 @@ lexer_remove(struct lexer *lx, struct token *tk, int keepfixes)
 		for (i++; i < VECTOR_LENGTH(lx->lx_stamps); i++)
 			lx->lx_stamps[i - 1] = lx->lx_stamps[i];
 		VECTOR_POP(lx->lx_stamps);
+		profile_free(PROFILE_TOKEN, sizeof(*lx->lx_stamps));
 	}
 
 	if (tk->tk_flags & TOKEN_FLAG_UNMUTE) {
@@ -1210,6 +1456,215 @@ lexer_eof(const struct lexer *lx)
 	return lx->lx_st.st_off == buffer_get_len(lx->lx_bf);
 }
 
+static int
+lexer_exec(struct lexer *lx, const struct lexer_arg *arg)
+{
+	VECTOR(struct token *) discarded;
+	int error = 0;
+
+	lx->lx_callbacks = arg->callbacks;
+	lx->lx_op = arg->op;
+	lx->lx_bf = arg->bf;
+	lx->lx_diff = arg->diff;
+	lx->lx_path = arg->path;
+	/*
+	 * Only tokens emitted by the C lexer can be decoded from the event
+	 * log.
+	 */
+	lx->lx_tracelog = arg->op->tracelog &&
+	    arg->callbacks.serialize == token_serialize;
+	if (arg->copy != NULL)
+		return lexer_exec_copy(lx, arg->copy);
+
+	lx->lx_st.st_lno = 1;
+	lx->lx_st.st_cno = 1;
+	lexer_line_alloc(lx, 1);
+
+	if (VECTOR_INIT(discarded))
+		err(1, NULL);
+
+	for (;;) {
+		struct token *tk;
+
+		tk = lexer_read(lx, &lx->lx_tokens);
+		if (tk == NULL) {
+			error = 1;
+			goto out;
+		}
+		if (tk->tk_flags & TOKEN_FLAG_DISCARD) {
+			struct token **dst;
+
+			dst = VECTOR_ALLOC(discarded);
+			if (dst == NULL)
+				err(1, NULL);
+			*dst = tk;
+		}
+		if (tk->tk_type == LEXER_EOF)
+			break;
+	}
+
+	while (!VECTOR_EMPTY(discarded)) {
+		struct token **tail;
+
+		tail = VECTOR_POP(discarded);
+		lexer_discard(lx, *tail);
+	}
+
+	if (trace(lx->lx_op, 't'))
+		lexer_dump(lx);
+
+out:
+	VECTOR_FREE(discarded);
+	return error;
+}
+
+static int
+lexer_exec_copy(struct lexer *lx, const struct lexer *src)
+{
+	VECTOR(struct token *) branches;
+	const struct token *tk;
+	size_t i;
+
+	assert(lx->lx_bf == src->lx_bf);
+
+	for (i = 0; i < VECTOR_LENGTH(src->lx_lines); i++) {
+		size_t *dst;
+
+		dst = VECTOR_ALLOC(lx->lx_lines);
+		if (dst == NULL)
+			err(1, NULL);
+		*dst = src->lx_lines[i];
+	}
+	profile_alloc(PROFILE_SOURCE, "LINE", NULL, 0,
+	    VECTOR_LENGTH(lx->lx_lines) * sizeof(*lx->lx_lines));
+
+	if (VECTOR_INIT(branches))
+		err(1, NULL);
+
+	TAILQ_FOREACH(tk, &src->lx_tokens, tk_entry) {
+		const struct token *fix;
+		struct token *cp;
+
+		cp = lexer_copy_token(lx, tk);
+		TAILQ_FOREACH(fix, &tk->tk_prefixes, tk_entry) {
+			struct token **last;
+			struct token *prefix;
+
+			prefix = lexer_copy_token(lx, fix);
+			if (fix->tk_branch.br_parent != NULL)
+				prefix->tk_branch.br_parent = cp;
+			TAILQ_INSERT_TAIL(&cp->tk_prefixes, prefix, tk_entry);
+
+			/*
+			 * Branches are nested, link them the same way as while
+			 * lexing.
+			 */
+			last = VECTOR_LAST(branches);
+			switch (prefix->tk_type) {
+			case TOKEN_CPP_IF:
+				last = VECTOR_ALLOC(branches);
+				if (last == NULL)
+					err(1, NULL);
+				*last = prefix;
+				break;
+			case TOKEN_CPP_ELSE:
+			case TOKEN_CPP_ENDIF:
+				assert(last != NULL);
+				(*last)->tk_branch.br_nx = prefix;
+				prefix->tk_branch.br_pv = *last;
+				if (prefix->tk_type == TOKEN_CPP_ELSE)
+					*last = prefix;
+				else
+					VECTOR_POP(branches);
+				break;
+			}
+		}
+		TAILQ_FOREACH(fix, &tk->tk_suffixes, tk_entry) {
+			struct token *suffix;
+
+			suffix = lexer_copy_token(lx, fix);
+			TAILQ_INSERT_TAIL(&cp->tk_suffixes, suffix, tk_entry);
+		}
+		TAILQ_INSERT_TAIL(&lx->lx_tokens, cp, tk_entry);
+	}
+	assert(VECTOR_EMPTY(branches));
+	VECTOR_FREE(branches);
+
+	lx->lx_st = src->lx_st;
+	lx->lx_st.st_tk = NULL;
+	lx->lx_st.st_err = 0;
+	lx->lx_eof = src->lx_eof;
+	return 0;
+}
+
+/*
+ * Read the next token and append it to the given list. Returns NULL on error.
+ */
+static struct token *
+lexer_read(struct lexer *lx, struct token_list *tokens)
+{
+	struct token *tk;
+
+	tk = lx->lx_callbacks.read(lx, lx->lx_callbacks.arg);
+	if (tk == NULL)
+		return NULL;
+	TAILQ_INSERT_TAIL(tokens, tk, tk_entry);
+	if (unlikely(profile_exhausted())) {
+		lexer_error(lx, tk, __func__, __LINE__,
+		    "memory limit exceeded");
+		lexer_error_flush(lx);
+		return NULL;
+	}
+	if (tk->tk_flags & TOKEN_FLAG_DISCARD) {
+		/* Discarded tokens must leave the column intact. */
+		lx->lx_st.st_cno -= strwidth(tk->tk_str, tk->tk_len, 0);
+		if (lx->lx_st.st_cno == 0)
+			lx->lx_st.st_cno = 1;
+	}
+	return tk;
+}
+
+/*
+ * Remove a token discarded while reading. Reading can no longer resume after
+ * the previous token as it inherits the suffixes.
+ */
+static void
+lexer_discard(struct lexer *lx, struct token *tk)
+{
+	struct token *pv;
+
+	pv = token_prev(tk);
+	if (pv != NULL)
+		pv->tk_flags &= ~TOKEN_FLAG_RESUME;
+	lexer_remove(lx, tk, 1);
+}
+
+/*
+ * Release all tokens.
+ */
+static void
+lexer_release(struct lexer *lx)
+{
+	struct token *tk;
+
+	if (lx->lx_unmute != NULL) {
+		token_rele(lx->lx_unmute);
+		lx->lx_unmute = NULL;
+	}
+	while (!VECTOR_EMPTY(lx->lx_stamps)) {
+		struct token **tail;
+
+		tail = VECTOR_POP(lx->lx_stamps);
+		token_rele(*tail);
+		profile_free(PROFILE_TOKEN, sizeof(*tail));
+	}
+	while ((tk = TAILQ_FIRST(&lx->lx_tokens)) != NULL) {
+		TAILQ_REMOVE(&lx->lx_tokens, tk, tk_entry);
+		assert(tk->tk_refs == 1);
+		token_rele(tk);
+	}
+}
+
 static void
 lexer_line_alloc(struct lexer *lx, unsigned int lno)
 {
@@ -1223,6 +1678,67 @@ lexer_line_alloc(struct lexer *lx, unsigned int lno)
 	if (dst == NULL)
 		err(1, NULL);
 	*dst = lx->lx_st.st_off;
+	profile_alloc(PROFILE_SOURCE, "LINE", NULL, 0, sizeof(*dst));
+}
+
+static void
+lexer_line_edit(struct lexer *lx, size_t off, struct lexer_delta *ld)
+{
+	const char *buf = ld->ld_new;
+	const char *nl, *p;
+	size_t nins = 0;
+	size_t beg, end, i, len, nlines, nrm;
+
+	/* Find the lines starting within the removed bytes. */
+	nlines = VECTOR_LENGTH(lx->lx_lines);
+	beg = 0;
+	end = nlines;
+	while (beg < end) {
+		size_t mid = beg + (end - beg) / 2;
+
+		if (lx->lx_lines[mid] <= off)
+			beg = mid + 1;
+		else
+			end = mid;
+	}
+	for (end = beg;
+	    end < nlines && lx->lx_lines[end] <= off + ld->ld_rmlen; end++)
+		continue;
+	nrm = end - beg;
+
+	for (p = &buf[off], len = ld->ld_inslen;
+	    (nl = memchr(p, '\n', len)) != NULL; p = &nl[1]) {
+		len -= (size_t)(nl - p) + 1;
+		nins++;
+	}
+
+	for (i = nrm; i < nins; i++) {
+		if (VECTOR_ALLOC(lx->lx_lines) == NULL)
+			err(1, NULL);
+	}
+	memmove(&lx->lx_lines[beg + nins], &lx->lx_lines[end],
+	    (nlines - end) * sizeof(*lx->lx_lines));
+	for (i = nins; i < nrm; i++)
+		VECTOR_POP(lx->lx_lines);
+	for (i = beg + nins; i < VECTOR_LENGTH(lx->lx_lines); i++)
+		lx->lx_lines[i] += ld->ld_inslen - ld->ld_rmlen;
+
+	/* Add the lines starting within the inserted bytes. */
+	for (p = &buf[off], len = ld->ld_inslen, i = beg;
+	    (nl = memchr(p, '\n', len)) != NULL; p = &nl[1]) {
+		len -= (size_t)(nl - p) + 1;
+		lx->lx_lines[i++] = (size_t)(nl - buf) + 1;
+	}
+
+	if (nins > nrm) {
+		profile_alloc(PROFILE_SOURCE, "LINE", NULL, 0,
+		    (nins - nrm) * sizeof(*lx->lx_lines));
+	} else {
+		profile_free(PROFILE_SOURCE,
+		    (nrm - nins) * sizeof(*lx->lx_lines));
+	}
+	ld->ld_rmlines = (unsigned int)nrm;
+	ld->ld_inslines = (unsigned int)nins;
 }
 
 int
@@ -1260,8 +1776,8 @@ lexer_expect_error(struct lexer *lx, int type, const struct token *tk,
 
 	/* Be quiet while about to branch. */
 	if (lexer_back(lx, &t) && token_is_branch(t)) {
-		lexer_trace(lx, "%s:%d: suppressed, expected %s", fun, lno,
-		    lexer_serialize(lx, &(struct token){.tk_type = type}));
+		lexer_trace(lx, TRACELOG_LEXER_SUPPRESSED, fun, lno,
+		    &(struct token){.tk_type = type});
 		return;
 	}
 
@@ -1282,6 +1798,62 @@ lexer_expect_error(struct lexer *lx, int type, const struct token *tk,
 /*
  * Fold tokens covered by the branch into a prefix.
  */
+static int
+lexer_branch_take(struct lexer *lx)
+{
+	struct token *br, *dst, *rm, *tk;
+
+	if (!lexer_back(lx, &tk))
+		return 0;
+	br = token_get_branch(tk);
+	if (br == NULL)
+		return 0;
+	profile_cost(PROFILE_COST_BRANCH, br->tk_lno, 1);
+
+	dst = br->tk_branch.br_nx->tk_branch.br_parent;
+
+	lexer_trace(lx, TRACELOG_LEXER_BRANCH_TAKE,
+	    br, br->tk_branch.br_nx, br->tk_branch.br_parent,
+	    br->tk_branch.br_nx->tk_branch.br_parent);
+
+	token_branch_unlink(br);
+
+	rm = br->tk_branch.br_parent;
+	for (;;) {
+		struct token *nx;
+
+		lexer_trace(lx, TRACELOG_LEXER_BRANCH_TAKE_REMOVE, rm);
+
+		nx = token_next(rm);
+		lexer_remove(lx, rm, 0);
+		if (nx == dst)
+			break;
+		rm = nx;
+	}
+
+	/*
+	 * Tell doc_token() that crossing this token must cause tokens to be
+	 * emitted again. While here, disarm any previous unmute token as it
+	 * might be crossed again.
+	 */
+	if (lx->lx_unmute != NULL) {
+		lx->lx_unmute->tk_flags &= ~TOKEN_FLAG_UNMUTE;
+		token_rele(lx->lx_unmute);
+		lx->lx_unmute = NULL;
+	}
+	lexer_branch_unmute(lx, dst);
+	return 1;
+}
+
+static void
+lexer_branch_rewind(struct lexer *lx, struct token *seek)
+{
+	lexer_trace(lx, TRACELOG_LEXER_BRANCH_REWIND,
+	    seek ? seek : TAILQ_FIRST(&lx->lx_tokens));
+	lx->lx_st.st_tk = seek;
+	lx->lx_st.st_err = 0;
+}
+
 static void
 lexer_branch_fold(struct lexer *lx, struct token *src)
 {
@@ -1315,7 +1887,7 @@ lexer_branch_fold(struct lexer *lx, struct token *src)
 		struct token *pr;
 
 		pr = TAILQ_FIRST(&dst->tk_branch.br_parent->tk_prefixes);
-		lexer_trace(lx, "removing prefix %s", lexer_serialize(lx, pr));
+		lexer_trace(lx, TRACELOG_LEXER_BRANCH_FOLD_UNLINK, pr);
 		TAILQ_REMOVE(&dst->tk_branch.br_parent->tk_prefixes, pr,
 		    tk_entry);
 		/* Completely unlink any branch. */
@@ -1326,9 +1898,8 @@ lexer_branch_fold(struct lexer *lx, struct token *src)
 			break;
 	}
 
-	lexer_trace(lx, "add prefix %s to %s",
-	    lexer_serialize(lx, prefix),
-	    lexer_serialize(lx, dst->tk_branch.br_parent));
+	lexer_trace(lx, TRACELOG_LEXER_BRANCH_FOLD_PREFIX,
+	    prefix, dst->tk_branch.br_parent);
 	TAILQ_INSERT_HEAD(&dst->tk_branch.br_parent->tk_prefixes, prefix,
 	    tk_entry);
 
@@ -1343,7 +1914,7 @@ lexer_branch_fold(struct lexer *lx, struct token *src)
 		if (pv == NULL)
 			break;
 
-		lexer_trace(lx, "keeping prefix %s", lexer_serialize(lx, pv));
+		lexer_trace(lx, TRACELOG_LEXER_BRANCH_FOLD_KEEP, pv);
 		tmp = token_prev(pv);
 		token_move_prefix(pv, src->tk_branch.br_parent,
 		    dst->tk_branch.br_parent);
@@ -1362,7 +1933,7 @@ lexer_branch_fold(struct lexer *lx, struct token *src)
 			break;
 
 		nx = token_next(rm);
-		lexer_trace(lx, "removing %s", lexer_serialize(lx, rm));
+		lexer_trace(lx, TRACELOG_LEXER_BRANCH_FOLD_REMOVE, rm);
 		if (rm->tk_flags & TOKEN_FLAG_UNMUTE)
 			unmute = 1;
 		lexer_remove(lx, rm, 0);
@@ -1450,6 +2021,112 @@ lexer_recover_branch1(struct token *tk, unsigned int flags)
 	return NULL;
 }
 
+/*
+ * Find the top level declaration enclosing the given back token, starting the
+ * search from the given token. Any complete declaration preceding the back
+ * token is excluded. The declaration is not parsed but rather delimited by the
+ * first semicolon or right brace ending it, favoring speed over accuracy.
+ */
+static struct token *
+lexer_decl_span(struct token *tk, const struct token *back,
+    struct token **end)
+{
+	struct token *start = tk;
+	int depth = 0;
+	int seen = 0;
+
+	for (;;) {
+		struct token *nx;
+		int stop = 0;
+
+		nx = token_next(tk);
+		if (nx == NULL)
+			return NULL;
+		if (nx->tk_type == LEXER_EOF) {
+			*end = tk;
+			return start;
+		}
+		if (tk == back)
+			seen = 1;
+
+		switch (tk->tk_type) {
+		case TOKEN_LPAREN:
+		case TOKEN_LSQUARE:
+		case TOKEN_LBRACE:
+			depth++;
+			break;
+
+		case TOKEN_RPAREN:
+		case TOKEN_RSQUARE:
+			if (depth > 0)
+				depth--;
+			break;
+
+		case TOKEN_RBRACE:
+			if (depth > 0)
+				depth--;
+			/* A right brace in the first column ends a function. */
+			if (tk->tk_cno == 1)
+				depth = 0;
+			stop = depth == 0 && nx->tk_lno > tk->tk_lno;
+			break;
+
+		case TOKEN_SEMI:
+			stop = depth == 0;
+			break;
+
+		default:
+			break;
+		}
+
+		if (stop && seen) {
+			/*
+			 * Include redundant semicolons as they cannot be
+			 * parsed on their own.
+			 */
+			while (nx->tk_type == TOKEN_SEMI) {
+				tk = nx;
+				nx = token_next(tk);
+			}
+			*end = tk;
+			return start;
+		}
+		if (stop)
+			start = nx;
+		tk = nx;
+	}
+}
+
+/*
+ * Returns non-zero if the given range of tokens is not touched by any diff
+ * chunk. A token about to unmute must also be emitted and cpp branches are
+ * left to the parser.
+ */
+static int
+lexer_decl_is_unchanged(const struct token *beg, const struct token *end)
+{
+	const struct token *tk;
+
+	for (tk = beg;; tk = token_next(tk)) {
+		const struct token *fix;
+
+		if (tk->tk_flags & (TOKEN_FLAG_DIFF | TOKEN_FLAG_UNMUTE))
+			return 0;
+		TAILQ_FOREACH(fix, &tk->tk_prefixes, tk_entry) {
+			if ((fix->tk_flags & TOKEN_FLAG_DIFF) ||
+			    fix->tk_branch.br_parent != NULL)
+				return 0;
+		}
+		TAILQ_FOREACH(fix, &tk->tk_suffixes, tk_entry) {
+			if (fix->tk_flags & TOKEN_FLAG_DIFF)
+				return 0;
+		}
+		if (tk == end)
+			break;
+	}
+	return 1;
+}
+
 /*
  * Recalculate column and line numbers for all tokens on the given line number
  * starting from the given token.
@@ -1498,3 +2175,130 @@ lexer_reposition_tokens(struct lexer *UNUSED(lx), struct token *tk)
 			break;
 	}
 }
+
+static void
+lexer_trace0(struct lexer *lx, enum tracelog_event ev, ...)
+{
+	struct buffer *bf;
+	va_list ap;
+
+	va_start(ap, ev);
+	if (lx->lx_tracelog) {
+		tracelog_vrecord(ev, ap);
+		va_end(ap);
+		return;
+	}
+
+	bf = buffer_alloc(128);
+	if (bf == NULL)
+		err(1, NULL);
+	tracelog_vformat(bf, ev, ap, lexer_trace_serialize, lx);
+	va_end(ap);
+	buffer_putc(bf, '\0');
+	tracef(tracelog_ident(ev), tracelog_fun(ev), "%s", buffer_get_ptr(bf));
+	buffer_free(bf);
+}
+
+static const char *
+lexer_trace_serialize(void *arg, const struct token *tk)
+{
+	return lexer_serialize(arg, tk);
+}
+
+static struct token *
+lexer_copy_token(struct lexer *lx, const struct token *src)
+{
+	struct token *tk;
+
+	tk = lx->lx_callbacks.alloc(src);
+	memset(&tk->tk_branch, 0, sizeof(tk->tk_branch));
+	if (tk->tk_flags & TOKEN_FLAG_DIRTY) {
+		char *str;
+
+		str = emalloc(tk->tk_len + 1);
+		memcpy(str, src->tk_str, tk->tk_len);
+		str[tk->tk_len] = '\0';
+		tk->tk_str = str;
+		profile_alloc(PROFILE_TOKEN, "STRING", NULL, 0,
+		    tk->tk_len + 1);
+	}
+	return tk;
+}
+
+/*
+ * Move the given token including its prefixes and suffixes to the buffer after
+ * an edit.
+ */
+static void
+lexer_shift(const struct lexer *lx, struct token *tk,
+    const struct lexer_delta *ld)
+{
+	struct token *fix;
+
+	TAILQ_FOREACH(fix, &tk->tk_prefixes, tk_entry)
+		lexer_shift0(lx, fix, ld);
+	lexer_shift0(lx, tk, ld);
+	TAILQ_FOREACH(fix, &tk->tk_suffixes, tk_entry)
+		lexer_shift0(lx, fix, ld);
+}
+
+static void
+lexer_shift0(const struct lexer *lx, struct token *tk,
+    const struct lexer_delta *ld)
+{
+	size_t off = tk->tk_off - ld->ld_rmlen + ld->ld_inslen;
+
+	if (tk->tk_str == &ld->ld_old[tk->tk_off])
+		tk->tk_str = &ld->ld_new[off];
+	tk->tk_off = off;
+	tk->tk_lno = tk->tk_lno - ld->ld_rmlines + ld->ld_inslines;
+	if (lexer_get_diffchunk(lx, tk->tk_lno) != NULL)
+		tk->tk_flags |= TOKEN_FLAG_DIFF;
+	else
+		tk->tk_flags &= ~TOKEN_FLAG_DIFF;
+}
+
+/*
+ * Returns non-zero if reading resumed at the given offset in the buffer after
+ * the edit at the given offset yields the given token from before the edit.
+ * Reading must be able to resume from the token which in turn must start on a
+ * line not affected by the edit.
+ */
+static int
+lexer_resync(const struct token *tk, const struct lexer_delta *ld,
+    size_t editoff, size_t off)
+{
+	const struct token *pv;
+	size_t lineoff = 0;
+
+	if (tk->tk_type == LEXER_EOF)
+		return 0;
+	pv = token_prev(tk);
+	if (pv != NULL) {
+		if ((pv->tk_flags & TOKEN_FLAG_RESUME) == 0)
+			return 0;
+		lineoff = lexer_token_first(tk)->tk_off;
+		while (lineoff > 0 && ld->ld_old[lineoff - 1] != '\n')
+			lineoff--;
+	}
+	return lineoff >= editoff + ld->ld_rmlen &&
+	    lineoff - ld->ld_rmlen + ld->ld_inslen == off;
+}
+
+/*
+ * Returns the first token read as part of the given token, either one of its
+ * prefixes or the token itself. Prefixes are not necessarily ordered by offset
+ * as includes could have been sorted.
+ */
+static const struct token *
+lexer_token_first(const struct token *tk)
+{
+	const struct token *first = tk;
+	const struct token *prefix;
+
+	TAILQ_FOREACH(prefix, &tk->tk_prefixes, tk_entry) {
+		if (prefix->tk_off < first->tk_off)
+			first = prefix;
+	}
+	return first;
+}
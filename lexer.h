@@ -16,6 +16,12 @@ struct lexer_arg {
 	 */
 	int			 error_flush;
 
+	/*
+	 * Copy the tokens of the given lexer, which must operate on the same
+	 * buffer, instead of lexing the buffer again.
+	 */
+	const struct lexer	*copy;
+
 	struct lexer_callbacks {
 		/*
 		 * Read callback with the following semantics:
@@ -56,6 +62,9 @@ struct lexer_state {
 };
 
 struct lexer	*lexer_alloc(const struct lexer_arg *);
+int		 lexer_recycle(struct lexer *, const struct lexer_arg *);
+int		 lexer_edit(struct lexer *, const struct buffer *,
+    struct diffchunk *, size_t, size_t, size_t);
 void		 lexer_free(struct lexer *);
 
 struct lexer_state	lexer_get_state(const struct lexer *);
@@ -74,7 +83,7 @@ int		 lexer_eat_spaces(struct lexer *, struct token **);
 
 void	lexer_error(struct lexer *, const struct token *, const char *, int,
     const char *, ...) __attribute__((__format__(printf, 5, 6)));
-void	lexer_error_flush(struct lexer *);
+int	lexer_error_flush(struct lexer *);
 void	lexer_error_reset(struct lexer *);
 
 int		 lexer_buffer_streq(const struct lexer *,
@@ -89,11 +98,15 @@ int		lexer_get_lines(const struct lexer *, unsigned int,
 
 void	lexer_stamp(struct lexer *);
 int	lexer_recover(struct lexer *);
+int	lexer_recover_verbatim(struct lexer *);
 int	lexer_branch(struct lexer *);
+int	lexer_branch_seek(struct lexer *, struct token *);
 int	lexer_seek(struct lexer *, struct token *);
+int	lexer_seek_unchanged(struct lexer *);
 int	lexer_seek_after(struct lexer *, struct token *);
 
 int	lexer_is_branch(const struct lexer *);
+int	lexer_branch_start(const struct lexer *, struct token **);
 
 int	lexer_pop(struct lexer *, struct token **);
 int	lexer_back(const struct lexer *, struct token **);
@@ -0,0 +1,457 @@
+#include "libknfmt.h"
+
+#include "config.h"
+
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libks/buffer.h"
+#include "libks/vector.h"
+
+#include "alloc.h"
+#include "clang.h"
+#include "diff.h"
+#include "expr.h"
+#include "lexer.h"
+#include "options.h"
+#include "parser.h"
+#include "rope.h"
+#include "simple.h"
+#include "style.h"
+#include "token.h"
+
+struct knfmt {
+	struct options	 kf_op;
+	struct style	*kf_st;
+	struct simple	*kf_si;
+	struct clang	*kf_cl;
+	struct lexer	*kf_lx;		/* lexer reused across invocations */
+	struct parser	*kf_pr;		/* parser reused across invocations */
+	struct buffer	*kf_src;	/* source reused across invocations */
+	struct buffer	*kf_dst;	/* result reused across invocations */
+};
+
+struct knfmt_changes {
+	struct knfmt			*kc_kf;
+	struct lexer			*kc_lx;		/* tokens of current source */
+	struct buffer			*kc_bf;		/* current source */
+	struct buffer			*kc_tmp;	/* scratch while editing */
+	/* Lines changed since the last format, sorted and disjoint. */
+	VECTOR(struct diffchunk)	 kc_chunks;
+};
+
+static int	knfmt_exec(struct knfmt *, const struct buffer *,
+    struct diffchunk *, const struct lexer *);
+
+static int	changes_lex(struct knfmt_changes *);
+static void	changes_edit(struct knfmt_changes *, struct buffer *, size_t,
+    size_t, size_t);
+static void	changes_chunk(struct knfmt_changes *, unsigned int,
+    unsigned int, unsigned int);
+static int	changes_chunk_cmp(const struct diffchunk *,
+    const struct diffchunk *);
+
+static unsigned int	nlines(const char *, size_t);
+
+void
+knfmt_init(void)
+{
+	clang_init();
+	expr_init();
+	style_init();
+}
+
+void
+knfmt_shutdown(void)
+{
+	style_shutdown();
+	clang_shutdown();
+}
+
+/*
+ * Allocate a formatting context. The optional style is expected to have the
+ * same format as a .clang-format file.
+ */
+struct knfmt *
+knfmt_alloc(const char *style, size_t stylelen, unsigned int flags)
+{
+	struct knfmt *kf;
+
+	kf = ecalloc(1, sizeof(*kf));
+	options_init(&kf->kf_op);
+	kf->kf_op.simple = (flags & KNFMT_SIMPLE) ? 1 : 0;
+
+	if (style != NULL) {
+		struct buffer *bf;
+
+		bf = buffer_alloc(stylelen + 1);
+		if (bf == NULL || buffer_puts(bf, style, stylelen))
+			err(1, NULL);
+		kf->kf_st = style_parse_buffer(bf, ".clang-format", &kf->kf_op);
+		buffer_free(bf);
+	} else {
+		kf->kf_st = style_parse_buffer(NULL, ".clang-format",
+		    &kf->kf_op);
+	}
+	kf->kf_si = simple_alloc(&kf->kf_op);
+	kf->kf_cl = clang_alloc(kf->kf_st, kf->kf_si, &kf->kf_op);
+	kf->kf_src = buffer_alloc(1 << 12);
+	if (kf->kf_src == NULL)
+		err(1, NULL);
+	kf->kf_dst = buffer_alloc(1 << 12);
+	if (kf->kf_dst == NULL)
+		err(1, NULL);
+	return kf;
+}
+
+void
+knfmt_free(struct knfmt *kf)
+{
+	if (kf == NULL)
+		return;
+
+	parser_free(kf->kf_pr);
+	lexer_free(kf->kf_lx);
+	buffer_free(kf->kf_dst);
+	buffer_free(kf->kf_src);
+	clang_free(kf->kf_cl);
+	simple_free(kf->kf_si);
+	style_free(kf->kf_st);
+	free(kf);
+}
+
+/*
+ * Format the given source code. Returns the formatted source code which is
+ * valid until the next invocation using the same context, or NULL if the
+ * source code could not be parsed.
+ */
+const char *
+knfmt_format(struct knfmt *kf, const char *src, size_t srclen,
+    size_t *dstlen)
+{
+	buffer_reset(kf->kf_src);
+	if (buffer_puts(kf->kf_src, src, srclen))
+		err(1, NULL);
+	if (knfmt_exec(kf, kf->kf_src, NULL, NULL))
+		return NULL;
+	if (dstlen != NULL)
+		*dstlen = buffer_get_len(kf->kf_dst);
+	return buffer_get_ptr(kf->kf_dst);
+}
+
+/*
+ * Track changes made to the given source code, using the given context which
+ * must outlive the returned object. The source code is expected to be mutated
+ * using knfmt_changes_edit() followed by knfmt_changes_format() which only
+ * formats the changed lines, the equivalent of the -D option. The tokens are
+ * retained between invocations and only the lines affected by each edit are
+ * lexed again.
+ */
+struct knfmt_changes *
+knfmt_changes_alloc(struct knfmt *kf, const char *src, size_t srclen)
+{
+	struct knfmt_changes *kc;
+
+	kc = ecalloc(1, sizeof(*kc));
+	kc->kc_kf = kf;
+	kc->kc_bf = buffer_alloc(srclen + 1);
+	if (kc->kc_bf == NULL || buffer_puts(kc->kc_bf, src, srclen))
+		err(1, NULL);
+	kc->kc_tmp = buffer_alloc(srclen + 1);
+	if (kc->kc_tmp == NULL)
+		err(1, NULL);
+	if (VECTOR_INIT(kc->kc_chunks))
+		err(1, NULL);
+	/* Lexing is attempted again while formatting on error. */
+	(void)changes_lex(kc);
+	return kc;
+}
+
+void
+knfmt_changes_free(struct knfmt_changes *kc)
+{
+	if (kc == NULL)
+		return;
+
+	lexer_free(kc->kc_lx);
+	VECTOR_FREE(kc->kc_chunks);
+	buffer_free(kc->kc_tmp);
+	buffer_free(kc->kc_bf);
+	free(kc);
+}
+
+/*
+ * Replace the given number of bytes at the given offset with the given
+ * bytes. Returns non-zero if the range is out of bounds.
+ */
+int
+knfmt_changes_edit(struct knfmt_changes *kc, size_t off, size_t rmlen,
+    const char *ins, size_t inslen)
+{
+	const char *src = buffer_get_ptr(kc->kc_bf);
+	size_t srclen = buffer_get_len(kc->kc_bf);
+	struct buffer *tmp;
+	unsigned int beg, insend, lno, rmend;
+
+	if (off > srclen || rmlen > srclen - off)
+		return 1;
+
+	lno = nlines(src, off) + 1;
+	rmend = lno + nlines(&src[off], rmlen);
+	insend = lno + nlines(ins, inslen);
+	/*
+	 * The line following an edit ending on a line boundary is left
+	 * untouched, likewise for the line preceding an edit starting on a line
+	 * boundary.
+	 */
+	if (insend > lno && ins[inslen - 1] == '\n' &&
+	    (off + rmlen == 0 || src[off + rmlen - 1] == '\n')) {
+		rmend--;
+		insend--;
+	}
+	beg = lno;
+	if (inslen > 0 && ins[0] == '\n' &&
+	    (off == srclen || src[off] == '\n'))
+		beg++;
+	changes_chunk(kc, beg, rmend, insend);
+
+	tmp = kc->kc_tmp;
+	buffer_reset(tmp);
+	if (buffer_puts(tmp, src, off) ||
+	    buffer_puts(tmp, ins, inslen) ||
+	    buffer_puts(tmp, &src[off + rmlen], srclen - off - rmlen))
+		err(1, NULL);
+	changes_edit(kc, tmp, off, rmlen, inslen);
+	kc->kc_tmp = kc->kc_bf;
+	kc->kc_bf = tmp;
+	return 0;
+}
+
+/*
+ * Format all lines changed since the last invocation. The top level
+ * declarations not touched by any change are neither parsed nor formatted.
+ * Returns the whole source code which is valid until the next invocation
+ * using the same object, or NULL if the source code could not be parsed.
+ */
+const char *
+knfmt_changes_format(struct knfmt_changes *kc, size_t *dstlen)
+{
+	struct knfmt *kf = kc->kc_kf;
+
+	if (!VECTOR_EMPTY(kc->kc_chunks)) {
+		const char *dst, *src;
+		struct buffer *tmp;
+		size_t beg, dstlen0, end, srclen;
+
+		if (changes_lex(kc))
+			return NULL;
+		kf->kf_op.diffparse = 1;
+		if (knfmt_exec(kf, kc->kc_bf, kc->kc_chunks, kc->kc_lx)) {
+			kf->kf_op.diffparse = 0;
+			return NULL;
+		}
+		kf->kf_op.diffparse = 0;
+		VECTOR_CLEAR(kc->kc_chunks);
+
+		/*
+		 * The formatted source code becomes the current one, only the
+		 * bytes in between the common prefix and suffix are considered
+		 * changed.
+		 */
+		src = buffer_get_ptr(kc->kc_bf);
+		srclen = buffer_get_len(kc->kc_bf);
+		dst = buffer_get_ptr(kf->kf_dst);
+		dstlen0 = buffer_get_len(kf->kf_dst);
+		for (beg = 0; beg < srclen && beg < dstlen0; beg++) {
+			if (src[beg] != dst[beg])
+				break;
+		}
+		for (end = 0; end < srclen - beg && end < dstlen0 - beg; end++) {
+			if (src[srclen - end - 1] != dst[dstlen0 - end - 1])
+				break;
+		}
+		changes_edit(kc, kf->kf_dst, beg, srclen - beg - end,
+		    dstlen0 - beg - end);
+		tmp = kc->kc_bf;
+		kc->kc_bf = kf->kf_dst;
+		kf->kf_dst = tmp;
+	}
+
+	if (dstlen != NULL)
+		*dstlen = buffer_get_len(kc->kc_bf);
+	return buffer_get_ptr(kc->kc_bf);
+}
+
+static int
+knfmt_exec(struct knfmt *kf, const struct buffer *src,
+    struct diffchunk *chunks, const struct lexer *copy)
+{
+	struct lexer_arg arg = {
+		.path		= "<stdin>",
+		.bf		= src,
+		.diff		= chunks,
+		.op		= &kf->kf_op,
+		.copy		= copy,
+		.callbacks	= {
+			.read		= clang_read,
+			.alloc		= token_alloc,
+			.serialize	= token_serialize,
+			.arg		= kf->kf_cl,
+		},
+	};
+	struct rope *dst;
+
+	if (kf->kf_lx == NULL) {
+		kf->kf_lx = lexer_alloc(&arg);
+		if (kf->kf_lx == NULL)
+			return 1;
+	} else if (lexer_recycle(kf->kf_lx, &arg)) {
+		return 1;
+	}
+	if (kf->kf_pr == NULL) {
+		kf->kf_pr = parser_alloc(kf->kf_lx, kf->kf_st, kf->kf_si,
+		    &kf->kf_op);
+	} else {
+		parser_recycle(kf->kf_pr, kf->kf_st);
+	}
+	dst = parser_exec(kf->kf_pr, chunks, src);
+	if (dst == NULL)
+		return 1;
+
+	buffer_reset(kf->kf_dst);
+	rope_flatten(dst, kf->kf_dst);
+	return 0;
+}
+
+/*
+ * Lex the current source code unless already done. Returns non-zero on error.
+ */
+static int
+changes_lex(struct knfmt_changes *kc)
+{
+	struct knfmt *kf = kc->kc_kf;
+
+	if (kc->kc_lx != NULL)
+		return 0;
+
+	/* Includes are only sorted on changed lines. */
+	kf->kf_op.diffparse = 1;
+	kc->kc_lx = lexer_alloc(&(const struct lexer_arg){
+	    .path	= "<stdin>",
+	    .bf		= kc->kc_bf,
+	    .diff	= kc->kc_chunks,
+	    .op		= &kf->kf_op,
+	    .callbacks	= {
+		.read		= clang_read,
+		.alloc		= token_alloc,
+		.serialize	= token_serialize,
+		.arg		= kf->kf_cl,
+	    },
+	});
+	kf->kf_op.diffparse = 0;
+	return kc->kc_lx == NULL;
+}
+
+/*
+ * Let the tokens reflect the given buffer, being the result of replacing the
+ * given number of bytes at the given offset with the given number of bytes. The
+ * tokens are discarded on error and the whole source code is lexed again by
+ * the next invocation of changes_lex().
+ */
+static void
+changes_edit(struct knfmt_changes *kc, struct buffer *bf, size_t off,
+    size_t rmlen, size_t inslen)
+{
+	struct knfmt *kf = kc->kc_kf;
+	int error;
+
+	if (kc->kc_lx == NULL)
+		return;
+
+	kf->kf_op.diffparse = 1;
+	error = lexer_edit(kc->kc_lx, bf, kc->kc_chunks, off, rmlen, inslen);
+	kf->kf_op.diffparse = 0;
+	if (error) {
+		lexer_free(kc->kc_lx);
+		kc->kc_lx = NULL;
+	}
+}
+
+/*
+ * Register an edit starting at the given line, replacing all lines up to and
+ * including rmend with all lines up to and including insend. Any of the two
+ * ranges is empty if its end precedes the start line. Chunks of previous edits
+ * are shifted or merged accordingly.
+ */
+static void
+changes_chunk(struct knfmt_changes *kc, unsigned int beg, unsigned int rmend,
+    unsigned int insend)
+{
+	struct diffchunk *dst;
+	struct diffchunk du = {
+		.du_beg	= beg,
+		.du_end	= insend,
+	};
+	size_t i = 0;
+
+	while (i < VECTOR_LENGTH(kc->kc_chunks)) {
+		struct diffchunk *pv = &kc->kc_chunks[i];
+
+		if (pv->du_end < beg) {
+			i++;
+			continue;
+		}
+		if (pv->du_beg > rmend) {
+			pv->du_beg = (pv->du_beg - rmend) + insend;
+			pv->du_end = (pv->du_end - rmend) + insend;
+			i++;
+			continue;
+		}
+
+		/* Overlapping chunk, merge with the edit. */
+		if (pv->du_beg < du.du_beg)
+			du.du_beg = pv->du_beg;
+		if (pv->du_end > rmend &&
+		    (pv->du_end - rmend) + insend > du.du_end)
+			du.du_end = (pv->du_end - rmend) + insend;
+		*pv = *VECTOR_LAST(kc->kc_chunks);
+		VECTOR_POP(kc->kc_chunks);
+	}
+
+	if (du.du_beg <= du.du_end) {
+		dst = VECTOR_ALLOC(kc->kc_chunks);
+		if (dst == NULL)
+			err(1, NULL);
+		*dst = du;
+	}
+	VECTOR_SORT(kc->kc_chunks, changes_chunk_cmp);
+}
+
+static int
+changes_chunk_cmp(const struct diffchunk *a, const struct diffchunk *b)
+{
+	if (a->du_beg < b->du_beg)
+		return -1;
+	if (a->du_beg > b->du_beg)
+		return 1;
+	return 0;
+}
+
+static unsigned int
+nlines(const char *str, size_t len)
+{
+	unsigned int n = 0;
+
+	while (len > 0) {
+		const char *nl;
+
+		nl = memchr(str, '\n', len);
+		if (nl == NULL)
+			break;
+		n++;
+		len -= (size_t)(nl - str) + 1;
+		str = &nl[1];
+	}
+	return n;
+}
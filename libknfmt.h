@@ -0,0 +1,35 @@
+#include <stddef.h>	/* size_t */
+
+/*
+ * Embeddable interface, formatting source code held in memory without
+ * touching the filesystem. A context is expected to be reused across many
+ * invocations of knfmt_format(). Separate contexts can be used concurrently
+ * from different threads. Allocation failures are considered fatal.
+ */
+
+struct knfmt;
+struct knfmt_changes;
+
+/* Simplify the source code, equivalent of the -s option. */
+#define KNFMT_SIMPLE	0x00000001u
+
+/*
+ * Initialize and tear down global lookup tables. Must be called once before
+ * any context is allocated respectively after all contexts are freed, and not
+ * concurrently with any other function.
+ */
+void	knfmt_init(void);
+void	knfmt_shutdown(void);
+
+struct knfmt	*knfmt_alloc(const char *, size_t, unsigned int);
+void		 knfmt_free(struct knfmt *);
+
+const char	*knfmt_format(struct knfmt *, const char *, size_t, size_t *);
+
+struct knfmt_changes	*knfmt_changes_alloc(struct knfmt *, const char *,
+    size_t);
+void			 knfmt_changes_free(struct knfmt_changes *);
+
+int		 knfmt_changes_edit(struct knfmt_changes *, size_t, size_t,
+    const char *, size_t);
+const char	*knfmt_changes_format(struct knfmt_changes *, size_t *);
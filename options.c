@@ -2,15 +2,42 @@
 
 #include "config.h"
 
+#include <assert.h>
 #include <err.h>
 #include <limits.h>
 #include <string.h>
 
+#include "libks/compiler.h"
+
 static int	ctotrace(char c);
 
+/*
+ * Maps each trace flag to its index in traces plus one, allowing trace() to
+ * resolve a flag in constant time.
+ */
+static const unsigned char tracetab[UCHAR_MAX + 1] = {
+	['a']	= 1,
+	['c']	= 2,
+	['C']	= 3,
+	['d']	= 4,
+	['D']	= 5,
+	['f']	= 6,
+	['l']	= 7,
+	['m']	= 8,
+	['p']	= 9,
+	['s']	= 10,
+	['S']	= 11,
+	['t']	= 12,
+};
+
 void
 options_init(struct options *op)
 {
+	size_t i;
+
+	for (i = 0; i < sizeof(traces); i++)
+		assert(ctotrace(traces[i]) == (int)i);
+
 	memset(op, 0, sizeof(*op));
 }
 
@@ -20,6 +47,15 @@ options_trace_parse(struct options *op, const char *flags)
 	for (; *flags != '\0'; flags++) {
 		int idx;
 
+		/*
+		 * Record lexer and document traces in the binary event log,
+		 * deliberately not implied by all traces.
+		 */
+		if (*flags == 'b') {
+			op->tracelog = 1;
+			continue;
+		}
+
 		idx = ctotrace(*flags);
 		if (idx == -1) {
 			warnx("%c: unknown trace flag", *flags);
@@ -29,8 +65,10 @@ options_trace_parse(struct options *op, const char *flags)
 
 			for (i = 0; i < sizeof(traces); i++)
 				op->op_trace[i] = UINT_MAX;
+			op->op_tracemask = UINT_MAX;
 		} else {
 			op->op_trace[idx]++;
+			op->op_tracemask |= 1u << idx;
 		}
 	}
 	return 0;
@@ -41,19 +79,17 @@ trace(const struct options *op, char c)
 {
 	int idx;
 
+	/* Tracing is rarely enabled, favor the common case. */
+	if (likely(op->op_tracemask == 0))
+		return 0;
 	idx = ctotrace(c);
-	return idx == -1 ? 0 : op->op_trace[idx];
+	if (idx == -1 || (op->op_tracemask & (1u << idx)) == 0)
+		return 0;
+	return op->op_trace[idx];
 }
 
 static int
 ctotrace(char c)
 {
-	int len = sizeof(traces);
-	int i;
-
-	for (i = 0; i < len; i++) {
-		if (traces[i] == c)
-			return i;
-	}
-	return -1;
+	return tracetab[(unsigned char)c] - 1;
 }
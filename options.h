@@ -1,3 +1,5 @@
+#include <stddef.h>	/* size_t */
+
 static const char traces[] = {
 	'a',	/* all */
 	'c',	/* clang */
@@ -6,6 +8,8 @@ static const char traces[] = {
 	'D',	/* diff */
 	'f',	/* func:line */
 	'l',	/* lexer */
+	'm',	/* memory */
+	'p',	/* profile */
 	's',	/* style */
 	'S',	/* simple */
 	't',	/* token */
@@ -13,12 +17,21 @@ static const char traces[] = {
 
 struct options {
 	unsigned int	op_trace[sizeof(traces)];
+	/* Bitmask of enabled traces, allows trace() to bail out early. */
+	unsigned int	op_tracemask;
+	/* Maximum number of threads formatting a single file. */
+	unsigned int	op_jobs;
+	/* Maximum number of bytes allocated while formatting a file. */
+	size_t		op_memlimit;
 
 	unsigned int	diff:1,
 			diffparse:1,
 			inplace:1,
+			recover:1,
 			simple:1,
-			test:1;
+			test:1,
+			tracelog:1,
+			watch:1;
 };
 
 void	options_init(struct options *);
@@ -5,6 +5,7 @@
 #include "doc.h"
 #include "expr.h"
 #include "lexer.h"
+#include "options.h"
 #include "parser-cpp.h"
 #include "parser-expr.h"
 #include "parser-priv.h"
@@ -33,6 +34,9 @@ static int	parser_braces_field(struct parser *, struct braces_field_arg *);
 static int	parser_braces_field1(struct parser *,
     struct braces_field_arg *);
 
+static struct doc	*parser_braces_literal(struct parser *, struct doc *,
+    const struct token *);
+
 static struct token	*peek_expr_stop(struct parser *, struct token *);
 static struct token	*lbrace_cache(struct parser *, struct token *);
 static void		 lbrace_cache_purge(struct parser *);
@@ -164,7 +168,8 @@ parser_braces1(struct parser *pr, struct braces_arg *arg)
 			 */
 			if (align)
 				arg->col = newarg.col;
-		} else {
+		} else if ((expr = parser_braces_literal(pr, concat,
+		    rbrace)) == NULL) {
 			struct token *stop;
 
 			stop = peek_expr_stop(pr, rbrace);
@@ -355,6 +360,42 @@ parser_braces_field1(struct parser *pr, struct braces_field_arg *arg)
 	return parser_none(pr);
 }
 
+/*
+ * Fast path for the common case of a lone literal followed by a comma, as found
+ * in large generated tables. Emits the same documents as expr_exec() except
+ * for the groups, which are redundant as the token cannot cause any line break.
+ * Returns NULL if the next entry is not eligible.
+ */
+static struct doc *
+parser_braces_literal(struct parser *pr, struct doc *dc,
+    const struct token *rbrace)
+{
+	struct lexer *lx = pr->pr_lx;
+	struct token *nx, *tk;
+
+	/* Let the expression parser wrap each expression in parenthesis. */
+	if (pr->pr_op->test)
+		return NULL;
+
+	if (!lexer_peek(lx, &tk) ||
+	    (tk->tk_type != TOKEN_LITERAL && tk->tk_type != TOKEN_STRING &&
+	     tk->tk_type != TOKEN_IDENT) ||
+	    !token_is_bare(tk))
+		return NULL;
+	nx = token_next(tk);
+	if (nx == NULL || (nx->tk_type != TOKEN_COMMA && nx != rbrace) ||
+	    token_is_branch(nx))
+		return NULL;
+	if (!lexer_pop(lx, &tk))
+		return NULL;
+
+	dc = doc_max_lines(1, dc);
+	dc = doc_alloc(DOC_SCOPE, dc);
+	dc = doc_alloc(DOC_CONCAT, doc_alloc(DOC_OPTIONAL, dc));
+	doc_token(tk, dc);
+	return dc;
+}
+
 static struct token *
 peek_expr_stop(struct parser *pr, struct token *rbrace)
 {
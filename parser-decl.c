@@ -46,14 +46,11 @@ parser_decl_peek(struct parser *pr)
 {
 	struct lexer_state s;
 	struct lexer *lx = pr->pr_lx;
-	struct doc *dc;
 	int error;
 
-	dc = doc_alloc(DOC_CONCAT, NULL);
 	lexer_peek_enter(lx, &s);
-	error = parser_decl(pr, dc, 0);
+	error = parser_decl(pr, doc_sink(), 0);
 	lexer_peek_leave(lx, &s);
-	doc_free(dc);
 	return error & GOOD;
 }
 
@@ -455,7 +452,6 @@ parser_simple_decl_enter(struct parser *pr, unsigned int flags,
 {
 	struct lexer_state s;
 	struct lexer *lx = pr->pr_lx;
-	struct doc *dc;
 	unsigned int simple_flags;
 	int error;
 
@@ -464,11 +460,9 @@ parser_simple_decl_enter(struct parser *pr, unsigned int flags,
 		return parser_good(pr);
 
 	pr->pr_simple.decl = simple_decl_enter(lx, pr->pr_op);
-	dc = doc_alloc(DOC_CONCAT, NULL);
 	lexer_peek_enter(lx, &s);
-	error = parser_decl1(pr, dc, flags);
+	error = parser_decl1(pr, doc_sink(), flags);
 	lexer_peek_leave(lx, &s);
-	doc_free(dc);
 	if (error & GOOD)
 		simple_decl_leave(pr->pr_simple.decl);
 	simple_decl_free(pr->pr_simple.decl);
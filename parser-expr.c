@@ -26,6 +26,7 @@ parser_expr_peek(struct parser *pr, struct token **tk)
 		.st		= pr->pr_st,
 		.op		= pr->pr_op,
 		.lx		= pr->pr_lx,
+		.cache		= pr->pr_expr,
 		.callbacks	= {
 			.recover	= expr_recover,
 			.recover_cast	= expr_recover_cast,
@@ -51,6 +52,7 @@ parser_expr(struct parser *pr, struct doc **expr, struct parser_expr_arg *arg)
 		.rl		= arg->rl,
 		.dc		= arg->dc,
 		.stop		= arg->stop,
+		.cache		= pr->pr_expr,
 		.indent		= arg->indent,
 		.align		= arg->align,
 		.flags		= arg->flags,
@@ -145,18 +145,15 @@ parser_simple_decl_proto_enter(struct parser *pr, struct parser_type *type)
 	SIMPLE_COOKIE simple = {0};
 	struct lexer_state s;
 	struct lexer *lx = pr->pr_lx;
-	struct doc *dc;
 	int error;
 
 	if (!simple_enter(pr->pr_si, SIMPLE_DECL_PROTO, 0, &simple))
 		return parser_good(pr);
 
 	pr->pr_simple.decl_proto = simple_decl_proto_enter(pr->pr_lx);
-	dc = doc_alloc(DOC_CONCAT, NULL);
 	lexer_peek_enter(lx, &s);
-	error = parser_func_decl1(pr, dc, NULL, type);
+	error = parser_func_decl1(pr, doc_sink(), NULL, type);
 	lexer_peek_leave(lx, &s);
-	doc_free(dc);
 	if (error & GOOD)
 		simple_decl_proto_leave(pr->pr_simple.decl_proto);
 	simple_decl_proto_free(pr->pr_simple.decl_proto);
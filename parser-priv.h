@@ -17,8 +17,11 @@ struct parser {
 	const struct style	*pr_st;
 	struct simple		*pr_si;
 	struct lexer		*pr_lx;
-	struct buffer		*pr_scratch;
+	struct rope		*pr_scratch;
+	struct rope		*pr_out;	/* see parser_exec() */
+	struct expr_cache	*pr_expr;
 	unsigned int		 pr_error;
+	unsigned int		 pr_nrecovered;	/* # verbatim declarations */
 	unsigned int		 pr_nindent;	/* # indented stmt blocks */
 
 	struct {
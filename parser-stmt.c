@@ -2,6 +2,10 @@
 
 #include "config.h"
 
+#include <err.h>
+
+#include "libks/vector.h"
+
 #include "doc.h"
 #include "expr.h"
 #include "lexer.h"
@@ -35,6 +39,7 @@ static int	parser_stmt_continue(struct parser *, struct doc *);
 static int	parser_stmt_return(struct parser *, struct doc *);
 static int	parser_stmt_semi(struct parser *, struct doc *);
 static int	parser_stmt_cpp(struct parser *, struct doc *);
+static int	parser_stmt_block_branch(struct parser *, struct token **);
 
 static int		 parser_simple_stmt_enter(struct parser *,
     struct simple_cookie *);
@@ -48,12 +53,9 @@ static int		 peek_simple_stmt(struct parser *);
 int
 parser_stmt_peek(struct parser *pr)
 {
-	struct doc *dc;
 	int error;
 
-	dc = doc_alloc(DOC_CONCAT, NULL);
-	error = parser_stmt1(pr, dc);
-	doc_free(dc);
+	error = parser_stmt1(pr, doc_sink());
 	return error & GOOD;
 }
 
@@ -122,6 +124,7 @@ parser_stmt1(struct parser *pr, struct doc *dc)
 int
 parser_stmt_block(struct parser *pr, struct parser_stmt_block_arg *arg)
 {
+	VECTOR(struct token *) stamps;
 	struct doc *dc = arg->tail;
 	struct doc *concat, *indent, *line;
 	struct lexer *lx = pr->pr_lx;
@@ -180,12 +183,34 @@ parser_stmt_block(struct parser *pr, struct parser_stmt_block_arg *arg)
 		line = doc_alloc(DOC_HARDLINE, indent);
 	else
 		line = doc_literal(" ", indent);
-	while ((error = parser_stmt(pr, indent)) & GOOD) {
+	if (VECTOR_INIT(stamps))
+		err(1, NULL);
+	for (;;) {
+		struct token **stamp;
+
+		/*
+		 * Remember where each statement starts, allowing a branch to
+		 * be taken by only parsing the affected statements again.
+		 */
+		stamp = VECTOR_ALLOC(stamps);
+		if (stamp == NULL)
+			err(1, NULL);
+		lexer_back(lx, stamp);
+		token_ref(*stamp);
+
+		error = parser_stmt(pr, indent);
+		if ((error & BRCH) && parser_stmt_block_branch(pr, stamps))
+			continue;
+		if ((error & GOOD) == 0)
+			break;
 		nstmt++;
 		if (lexer_peek(lx, &tk) && tk == rbrace)
 			break;
 		doc_alloc(DOC_HARDLINE, indent);
 	}
+	while (!VECTOR_EMPTY(stamps))
+		token_rele(*VECTOR_POP(stamps));
+	VECTOR_FREE(stamps);
 	/* Do not keep the hard line if the statement block is empty. */
 	if (nstmt == 0 && (error & BRCH) == 0)
 		doc_remove(line, indent);
@@ -215,6 +240,47 @@ parser_stmt_block(struct parser *pr, struct parser_stmt_block_arg *arg)
 	return parser_good(pr);
 }
 
+/*
+ * Take the next branch by only parsing the affected statements again, rewinding
+ * to the closest statement starting before the branch. Returns zero if the
+ * branch starts before the first statement, leaving it to the caller.
+ */
+static int
+parser_stmt_block_branch(struct parser *pr, struct token **stamps)
+{
+	struct lexer *lx = pr->pr_lx;
+	struct token *back, *seek, *start;
+	int taken;
+
+	/*
+	 * Only applicable if the branch is reached at the beginning of a
+	 * statement, a partially parsed statement must be parsed again in its
+	 * entirety.
+	 */
+	if (!lexer_back(lx, &back) ||
+	    token_prev(back) != *VECTOR_LAST(stamps) ||
+	    !lexer_branch_start(lx, &start))
+		return 0;
+	while (!VECTOR_EMPTY(stamps)) {
+		struct token **last;
+
+		last = VECTOR_LAST(stamps);
+		if (token_cmp(*last, start) < 0)
+			break;
+		token_rele(*VECTOR_POP(stamps));
+	}
+	if (VECTOR_EMPTY(stamps))
+		return 0;
+
+	seek = *VECTOR_POP(stamps);
+	taken = lexer_branch_seek(lx, seek);
+	token_rele(seek);
+	if (!taken)
+		return 0;
+	parser_reset(pr);
+	return 1;
+}
+
 static int
 parser_stmt_if(struct parser *pr, struct doc *dc)
 {
@@ -786,7 +852,6 @@ static int
 parser_simple_stmt_enter(struct parser *pr, struct simple_cookie *simple)
 {
 	struct lexer_state s;
-	struct doc *dc;
 	struct lexer *lx = pr->pr_lx;
 	int error;
 
@@ -794,11 +859,9 @@ parser_simple_stmt_enter(struct parser *pr, struct simple_cookie *simple)
 		return parser_good(pr);
 
 	pr->pr_simple.stmt = simple_stmt_enter(lx, pr->pr_st, pr->pr_op);
-	dc = doc_alloc(DOC_CONCAT, NULL);
 	lexer_peek_enter(lx, &s);
-	error = parser_stmt1(pr, dc);
+	error = parser_stmt1(pr, doc_sink());
 	lexer_peek_leave(lx, &s);
-	doc_free(dc);
 	if (error & GOOD)
 		simple_stmt_leave(pr->pr_simple.stmt);
 	simple_stmt_free(pr->pr_simple.stmt);
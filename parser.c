@@ -2,14 +2,13 @@
 
 #include "config.h"
 
-#include <err.h>
 #include <stdlib.h>
 
-#include "libks/buffer.h"
 #include "libks/compiler.h"
 
 #include "alloc.h"
 #include "doc.h"
+#include "expr.h"
 #include "lexer.h"
 #include "options.h"
 #include "parser-decl.h"
@@ -17,6 +16,8 @@
 #include "parser-func.h"
 #include "parser-priv.h"
 #include "parser-stmt-asm.h"
+#include "profile.h"
+#include "rope.h"
 #include "token.h"
 
 static int
@@ -36,9 +37,8 @@ parser_alloc(struct lexer *lx, const struct style *st, struct simple *si,
 	pr->pr_si = si;
 	pr->pr_op = op;
 	pr->pr_lx = lx;
-	pr->pr_scratch = buffer_alloc(1024);
-	if (pr->pr_scratch == NULL)
-		err(1, NULL);
+	pr->pr_scratch = rope_alloc(NULL);
+	pr->pr_expr = expr_cache_alloc();
 	return pr;
 }
 
@@ -48,27 +48,60 @@ parser_free(struct parser *pr)
 	if (pr == NULL)
 		return;
 
-	buffer_free(pr->pr_scratch);
+	rope_free(pr->pr_out);
+	rope_free(pr->pr_scratch);
+	expr_cache_free(pr->pr_expr);
 	free(pr);
 }
 
-struct buffer *
+/*
+ * Reuse the parser for the next buffer of the underlying lexer, see
+ * lexer_recycle(), retaining allocations grown while parsing previous buffers.
+ */
+void
+parser_recycle(struct parser *pr, const struct style *st)
+{
+	pr->pr_st = st;
+	pr->pr_error = 0;
+	pr->pr_nindent = 0;
+	rope_reset(pr->pr_scratch);
+}
+
+/*
+ * Format the given source buffer. The returned rope is owned by the parser and
+ * only valid until the next invocation.
+ */
+struct rope *
 parser_exec(struct parser *pr, const struct diffchunk *diff_chunks,
-    size_t sizehint)
+    const struct buffer *src)
 {
-	struct buffer *bf = NULL;
+	struct rope *rp = NULL;
 	struct doc *dc;
 	struct lexer *lx = pr->pr_lx;
 	unsigned int doc_flags = 0;
 	int error = 0;
+	int ndocs = 0;
 
+	pr->pr_nrecovered = 0;
 	dc = doc_alloc(DOC_CONCAT, NULL);
 
 	for (;;) {
 		struct doc *concat;
 		struct token *tk;
 
+		/*
+		 * While only formatting changed lines, declarations not touched
+		 * by any diff chunk are emitted as is and there is no need to
+		 * parse them.
+		 */
+		if (pr->pr_op->diffparse && lexer_seek_unchanged(lx)) {
+			lexer_stamp(lx);
+			ndocs = 0;
+			continue;
+		}
+
 		concat = doc_alloc(DOC_CONCAT, dc);
+		ndocs++;
 
 		/* Always emit EOF token as it could have dangling tokens. */
 		if (lexer_if(lx, LEXER_EOF, &tk)) {
@@ -82,8 +115,19 @@ parser_exec(struct parser *pr, const struct diffchunk *diff_chunks,
 		}
 
 		error = parser_exec1(pr, concat);
+		if (unlikely(profile_exhausted())) {
+			/* Fail the file rather than the process. */
+			tk = NULL;
+			(void)lexer_back(lx, &tk);
+			lexer_error_reset(lx);
+			lexer_error(lx, tk, __func__, __LINE__,
+			    "memory limit exceeded");
+			error = FAIL;
+			break;
+		}
 		if (error & GOOD) {
 			lexer_stamp(lx);
+			ndocs = 0;
 		} else if (error & BRCH) {
 			if (!lexer_branch(lx))
 				break;
@@ -92,10 +136,33 @@ parser_exec(struct parser *pr, const struct diffchunk *diff_chunks,
 			int r;
 
 			r = lexer_recover(lx);
-			if (r == 0)
-				break;
+			if (r == 0) {
+				if (!pr->pr_op->recover)
+					break;
+				/*
+				 * Report the error and emit the whole declaration
+				 * verbatim, discarding all documents emitted since
+				 * the last stamped token. The error is usually
+				 * already queued by the failing declaration,
+				 * otherwise report its first token as the lexer
+				 * is positioned at the end of the previous
+				 * declaration.
+				 */
+				if (!lexer_error_flush(lx) &&
+				    lexer_peek(lx, &tk)) {
+					lexer_error(lx, tk, __func__, __LINE__,
+					    "error at %s",
+					    lexer_serialize(lx, tk));
+					lexer_error_flush(lx);
+				}
+				if (!lexer_recover_verbatim(lx))
+					break;
+				pr->pr_nrecovered++;
+				r = ndocs;
+			}
 			while (r-- > 0)
 				doc_remove_tail(dc);
+			ndocs = 0;
 			parser_reset(pr);
 		}
 	}
@@ -104,9 +171,11 @@ parser_exec(struct parser *pr, const struct diffchunk *diff_chunks,
 		goto out;
 	}
 
-	bf = buffer_alloc(sizehint);
-	if (bf == NULL)
-		err(1, NULL);
+	if (pr->pr_out == NULL)
+		pr->pr_out = rope_alloc(src);
+	else
+		rope_recycle(pr->pr_out, src);
+	rp = pr->pr_out;
 
 	if (pr->pr_op->diffparse)
 		doc_flags |= DOC_EXEC_DIFF;
@@ -118,7 +187,7 @@ parser_exec(struct parser *pr, const struct diffchunk *diff_chunks,
 	    .dc		= dc,
 	    .lx		= pr->pr_op->diffparse ? pr->pr_lx : NULL,
 	    .diff_chunks= pr->pr_op->diffparse ? diff_chunks : NULL,
-	    .bf		= bf,
+	    .rp		= rp,
 	    .st		= pr->pr_st,
 	    .op		= pr->pr_op,
 	    .flags	= doc_flags,
@@ -126,7 +195,19 @@ parser_exec(struct parser *pr, const struct diffchunk *diff_chunks,
 
 out:
 	doc_free(dc);
-	return bf;
+	/* Cached expressions must not outlive the tokens, see lexer_recycle(). */
+	expr_cache_reset(pr->pr_expr);
+	return rp;
+}
+
+/*
+ * Returns the number of declarations emitted verbatim due to parse errors by
+ * the last invocation of parser_exec().
+ */
+unsigned int
+parser_get_recovered(const struct parser *pr)
+{
+	return pr->pr_nrecovered;
 }
 
 int
@@ -197,10 +278,10 @@ parser_token_trim_after(const struct parser *UNUSED(pr), struct token *tk)
 unsigned int
 parser_width(struct parser *pr, const struct doc *dc)
 {
-	buffer_reset(pr->pr_scratch);
+	rope_reset(pr->pr_scratch);
 	return doc_width(&(struct doc_exec_arg){
 	    .dc	= dc,
-	    .bf	= pr->pr_scratch,
+	    .rp	= pr->pr_scratch,
 	    .st	= pr->pr_st,
 	    .op	= pr->pr_op,
 	});
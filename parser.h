@@ -1,5 +1,4 @@
-#include <stddef.h>	/* size_t */
-
+struct buffer;
 struct diffchunk;
 struct lexer;
 struct options;
@@ -9,4 +8,7 @@ struct style;
 struct parser	*parser_alloc(struct lexer *, const struct style *,
     struct simple *, const struct options *);
 void		 parser_free(struct parser *);
-struct buffer	*parser_exec(struct parser *, const struct diffchunk *, size_t);
+void		 parser_recycle(struct parser *, const struct style *);
+struct rope	*parser_exec(struct parser *, const struct diffchunk *,
+    const struct buffer *);
+unsigned int	 parser_get_recovered(const struct parser *);
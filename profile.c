@@ -0,0 +1,483 @@
+#include "profile.h"
+
+#include "config.h"
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libks/buffer.h"
+#include "libks/compiler.h"
+#include "libks/vector.h"
+
+#include "alloc.h"
+#include "options.h"
+#include "util.h"
+
+/* Number of allocation sites to report. */
+#define PROFILE_NSITES	20
+/* Number of source lines to report. */
+#define PROFILE_NLINES	20
+
+struct profile_entry {
+	const char	*name;
+	int		 lno;
+	unsigned long	 count;
+	size_t		 bytes;
+};
+
+/* Live and peak number of bytes. */
+struct profile_usage {
+	size_t	bytes;
+	size_t	peak;
+};
+
+/*
+ * Open addressing hash table keyed by name and line number. The names are
+ * expected to be string literals, favoring comparison by address.
+ */
+struct profile_table {
+	struct profile_entry	*entries;
+	size_t			 size;
+	size_t			 len;
+};
+
+static struct profile_entry	*profile_table_get(struct profile_table *,
+    const char *, int);
+static void			 profile_table_report(
+    const struct profile_table *, const char *, size_t,
+    const struct profile_usage *);
+static void			 profile_table_free(struct profile_table *);
+
+struct profile_line {
+	unsigned long	costs[PROFILE_COST_LAST];
+	unsigned long	total;
+	unsigned int	lno;
+};
+
+static int	profile_entry_cmp(const struct profile_entry *,
+    const struct profile_entry *);
+static int	profile_line_cmp(const struct profile_line *,
+    const struct profile_line *);
+static void	profile_cost_trace(const char *, const char *,
+    const unsigned long *);
+
+static void	*buffer_callback_alloc(size_t, void *);
+static void	*buffer_callback_realloc(void *, size_t, size_t, void *);
+static void	 buffer_callback_free(void *, size_t, void *);
+
+static const char *kindstr[PROFILE_LAST] = {
+	[PROFILE_DOC]		= "doc",
+	[PROFILE_EXPR]		= "expr",
+	[PROFILE_ROPE]		= "rope",
+	[PROFILE_RULER]		= "ruler",
+	[PROFILE_SOURCE]	= "source",
+	[PROFILE_TOKEN]		= "token",
+};
+
+/* Buffer callback arguments, one per kind. */
+static enum profile_kind buffer_kinds[PROFILE_LAST] = {
+	PROFILE_DOC,
+	PROFILE_EXPR,
+	PROFILE_ROPE,
+	PROFILE_RULER,
+	PROFILE_SOURCE,
+	PROFILE_TOKEN,
+};
+
+static const char *coststr[PROFILE_COST_LAST] = {
+	[PROFILE_COST_FITS]	= "fits",
+	[PROFILE_COST_WALK]	= "walk",
+	[PROFILE_COST_MINIMIZE]	= "minimize",
+	[PROFILE_COST_PEEK]	= "peek",
+	[PROFILE_COST_BRANCH]	= "branch",
+	[PROFILE_COST_RECOVER]	= "recover",
+	[PROFILE_COST_TOKEN]	= "token",
+	[PROFILE_COST_DOC]	= "doc",
+};
+
+static struct {
+	struct profile_table		sites;
+	struct profile_table		types[PROFILE_LAST];
+	struct profile_usage		usage[PROFILE_LAST];
+	struct profile_usage		total;
+	/* Maximum number of live bytes, zero if unlimited. */
+	size_t				limit;
+	/* Live bytes disregarded by the limit, see profile_limit_reset(). */
+	size_t				base;
+	/* Costs for the current file indexed by line number. */
+	VECTOR(struct profile_line)	lines;
+	/* Costs for the current file, including the ones lacking a line. */
+	unsigned long			costs[PROFILE_COST_LAST];
+	int				alloc;
+	int				cost;
+} profile;
+
+void
+profile_init(const struct options *op)
+{
+	profile.alloc = trace(op, 'm') > 0;
+	profile.limit = op->op_memlimit;
+	profile.cost = trace(op, 'p') > 0;
+	if (profile.cost && VECTOR_INIT(profile.lines))
+		err(1, NULL);
+}
+
+/*
+ * Report the aggregated allocations, done at exit.
+ */
+void
+profile_shutdown(void)
+{
+	size_t i;
+
+	if (profile.cost) {
+		VECTOR_FREE(profile.lines);
+		profile.cost = 0;
+	}
+
+	profile.limit = 0;
+	if (!profile.alloc)
+		return;
+
+	for (i = 0; i < PROFILE_LAST; i++) {
+		profile_table_report(&profile.types[i], kindstr[i], 0,
+		    &profile.usage[i]);
+		profile_table_free(&profile.types[i]);
+	}
+	tracef('M', "total", "%zu peak byte(s)", profile.total.peak);
+	profile_table_report(&profile.sites, "site", PROFILE_NSITES, NULL);
+	profile_table_free(&profile.sites);
+	profile.alloc = 0;
+}
+
+/*
+ * Account an allocation of the given kind and type. The function and line
+ * number refers to the allocation site and is optional.
+ */
+void
+profile_alloc(enum profile_kind kind, const char *type, const char *fun,
+    int lno, size_t siz)
+{
+	struct profile_usage *pu = &profile.usage[kind];
+	struct profile_entry *pe;
+
+	if (likely(!profile.alloc && profile.limit == 0))
+		return;
+
+	pu->bytes += siz;
+	if (pu->bytes > pu->peak)
+		pu->peak = pu->bytes;
+	profile.total.bytes += siz;
+	if (profile.total.bytes > profile.total.peak)
+		profile.total.peak = profile.total.bytes;
+
+	if (!profile.alloc)
+		return;
+	if (type == NULL)
+		type = "UNKNOWN";
+
+	pe = profile_table_get(&profile.types[kind], type, 0);
+	pe->count++;
+	pe->bytes += siz;
+
+	if (fun != NULL) {
+		pe = profile_table_get(&profile.sites, fun, lno);
+		pe->count++;
+		pe->bytes += siz;
+	}
+}
+
+/*
+ * Account the release of an allocation of the given kind.
+ */
+void
+profile_free(enum profile_kind kind, size_t siz)
+{
+	if (likely(!profile.alloc && profile.limit == 0))
+		return;
+
+	profile.usage[kind].bytes -= siz;
+	profile.total.bytes -= siz;
+	if (profile.total.bytes < profile.base)
+		profile.base = profile.total.bytes;
+}
+
+/*
+ * Let the memory limit only apply to allocations made from now on. Storage
+ * retained for reuse across files, see fileformat(), is therefore not held
+ * against the next file. Releasing storage lowers the disregarded bytes as
+ * needed, keeping them within the live bytes.
+ */
+void
+profile_limit_reset(void)
+{
+	profile.base = profile.total.bytes;
+}
+
+/*
+ * Returns non-zero if the memory limit is exceeded by the live allocations.
+ */
+int
+profile_exhausted(void)
+{
+	return profile.limit > 0 &&
+	    profile.total.bytes - profile.base > profile.limit;
+}
+
+/*
+ * Allocate a buffer whose storage is accounted as the given kind.
+ */
+struct buffer *
+profile_buffer_alloc(enum profile_kind kind, size_t siz)
+{
+	return buffer_alloc_impl(siz, &(struct buffer_callbacks){
+	    .alloc	= buffer_callback_alloc,
+	    .realloc	= buffer_callback_realloc,
+	    .free	= buffer_callback_free,
+	    .arg	= &buffer_kinds[kind],
+	});
+}
+
+/*
+ * Account work attributed to the given line number in the current file.
+ */
+void
+profile_cost(enum profile_cost cost, unsigned int lno, unsigned long n)
+{
+	struct profile_line *pl;
+
+	if (likely(!profile.cost))
+		return;
+	profile.costs[cost] += n;
+	if (lno == 0)
+		return;
+
+	while (VECTOR_LENGTH(profile.lines) <= lno) {
+		if (VECTOR_CALLOC(profile.lines) == NULL)
+			err(1, NULL);
+	}
+	pl = &profile.lines[lno];
+	pl->costs[cost] += n;
+}
+
+/*
+ * Get the accumulated work of the given kind in the current file.
+ */
+unsigned long
+profile_cost_get(enum profile_cost cost)
+{
+	return profile.costs[cost];
+}
+
+/*
+ * Report the accumulated work and the most expensive lines in the given file
+ * and reset the costs.
+ */
+void
+profile_cost_report(const char *path)
+{
+	size_t i;
+
+	if (!profile.cost)
+		return;
+
+	profile_cost_trace(path, "total", profile.costs);
+	memset(profile.costs, 0, sizeof(profile.costs));
+
+	for (i = 0; i < VECTOR_LENGTH(profile.lines); i++) {
+		struct profile_line *pl = &profile.lines[i];
+		size_t j;
+
+		pl->lno = (unsigned int)i;
+		pl->total = 0;
+		for (j = 0; j < PROFILE_COST_LAST; j++)
+			pl->total += pl->costs[j];
+	}
+	VECTOR_SORT(profile.lines, profile_line_cmp);
+
+	for (i = 0; i < VECTOR_LENGTH(profile.lines); i++) {
+		const struct profile_line *pl = &profile.lines[i];
+		char lno[16];
+
+		if (i == PROFILE_NLINES || pl->total == 0)
+			break;
+		(void)snprintf(lno, sizeof(lno), "%u", pl->lno);
+		profile_cost_trace(path, lno, pl->costs);
+	}
+	VECTOR_CLEAR(profile.lines);
+}
+
+static struct profile_entry *
+profile_table_get(struct profile_table *pt, const char *name, int lno)
+{
+	size_t i, mask;
+
+	if (2 * (pt->len + 1) > pt->size) {
+		struct profile_table old = *pt;
+
+		pt->size = old.size > 0 ? 2 * old.size : 256;
+		pt->entries = ecalloc(pt->size, sizeof(*pt->entries));
+		pt->len = 0;
+		for (i = 0; i < old.size; i++) {
+			const struct profile_entry *src = &old.entries[i];
+			struct profile_entry *dst;
+
+			if (src->name == NULL)
+				continue;
+			dst = profile_table_get(pt, src->name, src->lno);
+			*dst = *src;
+		}
+		free(old.entries);
+	}
+
+	mask = pt->size - 1;
+	i = (((uintptr_t)name >> 3) * 31 + (size_t)lno) & mask;
+	for (;; i = (i + 1) & mask) {
+		struct profile_entry *pe = &pt->entries[i];
+
+		if (pe->name == NULL) {
+			pe->name = name;
+			pe->lno = lno;
+			pt->len++;
+			return pe;
+		}
+		if (pe->name == name && pe->lno == lno)
+			return pe;
+	}
+}
+
+static void
+profile_table_report(const struct profile_table *pt, const char *header,
+    size_t limit, const struct profile_usage *pu)
+{
+	VECTOR(struct profile_entry) entries;
+	unsigned long count = 0;
+	size_t bytes = 0;
+	size_t i;
+
+	if (VECTOR_INIT(entries))
+		err(1, NULL);
+	for (i = 0; i < pt->size; i++) {
+		struct profile_entry *dst;
+
+		if (pt->entries[i].name == NULL)
+			continue;
+		dst = VECTOR_ALLOC(entries);
+		if (dst == NULL)
+			err(1, NULL);
+		*dst = pt->entries[i];
+		count += dst->count;
+		bytes += dst->bytes;
+	}
+	VECTOR_SORT(entries, profile_entry_cmp);
+
+	if (pu != NULL) {
+		tracef('M', header,
+		    "%lu allocation(s), %zu byte(s), %zu peak byte(s)",
+		    count, bytes, pu->peak);
+	} else {
+		tracef('M', header, "%lu allocation(s), %zu byte(s)", count,
+		    bytes);
+	}
+	for (i = 0; i < VECTOR_LENGTH(entries); i++) {
+		const struct profile_entry *pe = &entries[i];
+
+		if (limit > 0 && i == limit)
+			break;
+		if (pe->lno > 0) {
+			tracef('M', header, "%s:%d: %lu, %zu", pe->name,
+			    pe->lno, pe->count, pe->bytes);
+		} else {
+			tracef('M', header, "%s: %lu, %zu", pe->name,
+			    pe->count, pe->bytes);
+		}
+	}
+	VECTOR_FREE(entries);
+}
+
+static void
+profile_table_free(struct profile_table *pt)
+{
+	free(pt->entries);
+	pt->entries = NULL;
+	pt->size = 0;
+	pt->len = 0;
+}
+
+static int
+profile_entry_cmp(const struct profile_entry *a, const struct profile_entry *b)
+{
+	if (a->bytes < b->bytes)
+		return 1;
+	if (a->bytes > b->bytes)
+		return -1;
+	return 0;
+}
+
+static int
+profile_line_cmp(const struct profile_line *a, const struct profile_line *b)
+{
+	if (a->total < b->total)
+		return 1;
+	if (a->total > b->total)
+		return -1;
+	return 0;
+}
+
+static void *
+buffer_callback_alloc(size_t siz, void *arg)
+{
+	const enum profile_kind *kind = arg;
+	void *ptr;
+
+	ptr = malloc(siz);
+	if (ptr != NULL)
+		profile_alloc(*kind, "BUFFER", NULL, 0, siz);
+	return ptr;
+}
+
+static void *
+buffer_callback_realloc(void *ptr, size_t oldsiz, size_t newsiz, void *arg)
+{
+	const enum profile_kind *kind = arg;
+	void *newptr;
+
+	newptr = realloc(ptr, newsiz);
+	if (newptr != NULL) {
+		profile_free(*kind, oldsiz);
+		profile_alloc(*kind, "BUFFER", NULL, 0, newsiz);
+	}
+	return newptr;
+}
+
+static void
+buffer_callback_free(void *ptr, size_t siz, void *arg)
+{
+	const enum profile_kind *kind = arg;
+
+	if (ptr != NULL)
+		profile_free(*kind, siz);
+	free(ptr);
+}
+
+static void
+profile_cost_trace(const char *path, const char *prefix,
+    const unsigned long *costs)
+{
+	struct buffer *bf;
+	size_t i;
+
+	bf = buffer_alloc(128);
+	if (bf == NULL)
+		err(1, NULL);
+	for (i = 0; i < PROFILE_COST_LAST; i++) {
+		buffer_printf(bf, "%s%s %lu", i > 0 ? ", " : "", coststr[i],
+		    costs[i]);
+	}
+	buffer_putc(bf, '\0');
+	tracef('P', path, "%s: %s", prefix, buffer_get_ptr(bf));
+	buffer_free(bf);
+}
@@ -0,0 +1,43 @@
+#include <stddef.h>	/* size_t */
+
+struct buffer;
+struct options;
+
+enum profile_kind {
+	PROFILE_DOC,
+	PROFILE_EXPR,
+	PROFILE_ROPE,
+	PROFILE_RULER,
+	PROFILE_SOURCE,
+	PROFILE_TOKEN,
+
+	PROFILE_LAST, /* sentinel */
+};
+
+enum profile_cost {
+	PROFILE_COST_FITS,	/* doc_fits() invocations */
+	PROFILE_COST_WALK,	/* documents walked by doc_fits() */
+	PROFILE_COST_MINIMIZE,	/* minimizer trials */
+	PROFILE_COST_PEEK,	/* tokens scanned while peeking */
+	PROFILE_COST_BRANCH,	/* lexer_branch() invocations */
+	PROFILE_COST_RECOVER,	/* lexer_recover() invocations */
+	PROFILE_COST_TOKEN,	/* tokens allocated */
+	PROFILE_COST_DOC,	/* documents allocated */
+
+	PROFILE_COST_LAST, /* sentinel */
+};
+
+void	profile_init(const struct options *);
+void	profile_shutdown(void);
+
+void	profile_alloc(enum profile_kind, const char *, const char *, int,
+    size_t);
+void	profile_free(enum profile_kind, size_t);
+int	profile_exhausted(void);
+void	profile_limit_reset(void);
+
+struct buffer	*profile_buffer_alloc(enum profile_kind, size_t);
+
+void		profile_cost(enum profile_cost, unsigned int, unsigned long);
+unsigned long	profile_cost_get(enum profile_cost);
+void		profile_cost_report(const char *);
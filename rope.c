@@ -0,0 +1,407 @@
+#include "rope.h"
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <err.h>
+#include <limits.h>	/* IOV_MAX */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libks/buffer.h"
+#include "libks/vector.h"
+
+#include "alloc.h"
+#include "profile.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX	1024
+#endif
+
+/*
+ * Strings residing in the source buffer shorter than this are copied as
+ * referencing them would require more memory than the string itself.
+ */
+#define ROPE_SPAN_MIN	16
+
+struct rope_span {
+	const char	*ptr;	/* NULL if inline */
+	size_t		 off;	/* offset in inline buffer */
+	size_t		 len;
+};
+
+struct rope_undo {
+	struct rope_span	span;
+	size_t			idx;
+};
+
+/*
+ * Output represented as a sequence of spans, either referencing the source
+ * buffer or the inline buffer holding everything else. The inline buffer is
+ * append only while marked, allowing rope_restore() to be cheap.
+ */
+struct rope {
+	VECTOR(struct rope_span)	 rp_spans;
+	/* Modified spans covered by a mark. */
+	VECTOR(struct rope_undo)	 rp_undo;
+	struct buffer			*rp_inline;
+	const char			*rp_src;
+	size_t				 rp_srclen;
+	size_t				 rp_len;
+
+	/* Spans and inline data covered by a mark. */
+	struct {
+		size_t	nspans;
+		size_t	inline_len;
+	} rp_protect;
+};
+
+static struct rope_span	*rope_span_alloc(struct rope *);
+static void		 rope_span_save(struct rope *, size_t);
+static const char	*rope_span_ptr(const struct rope *,
+    const struct rope_span *);
+static int		 rope_is_source(const struct rope *, const char *,
+    size_t);
+
+/*
+ * Allocate a rope. Strings residing in the optional source buffer are
+ * referenced rather than copied, the source buffer must therefore outlive the
+ * rope.
+ */
+struct rope *
+rope_alloc(const struct buffer *src)
+{
+	struct rope *rp;
+
+	rp = ecalloc(1, sizeof(*rp));
+	if (VECTOR_INIT(rp->rp_spans))
+		err(1, NULL);
+	if (VECTOR_INIT(rp->rp_undo))
+		err(1, NULL);
+	rp->rp_inline = profile_buffer_alloc(PROFILE_ROPE, 1024);
+	if (rp->rp_inline == NULL)
+		err(1, NULL);
+	if (src != NULL) {
+		rp->rp_src = buffer_get_ptr(src);
+		rp->rp_srclen = buffer_get_len(src);
+	}
+	return rp;
+}
+
+void
+rope_free(struct rope *rp)
+{
+	if (rp == NULL)
+		return;
+	VECTOR_FREE(rp->rp_spans);
+	VECTOR_FREE(rp->rp_undo);
+	buffer_free(rp->rp_inline);
+	free(rp);
+}
+
+void
+rope_reset(struct rope *rp)
+{
+	VECTOR_CLEAR(rp->rp_spans);
+	VECTOR_CLEAR(rp->rp_undo);
+	buffer_reset(rp->rp_inline);
+	rp->rp_len = 0;
+	rp->rp_protect.nspans = 0;
+	rp->rp_protect.inline_len = 0;
+}
+
+/*
+ * Reset the rope and reference strings residing in the given source buffer
+ * instead, see rope_alloc().
+ */
+void
+rope_recycle(struct rope *rp, const struct buffer *src)
+{
+	rope_reset(rp);
+	rp->rp_src = buffer_get_ptr(src);
+	rp->rp_srclen = buffer_get_len(src);
+}
+
+void
+rope_puts(struct rope *rp, const char *str, size_t len)
+{
+	struct rope_span *last;
+	size_t off;
+
+	if (len == 0)
+		return;
+	rp->rp_len += len;
+
+	last = VECTOR_LAST(rp->rp_spans);
+	if (rope_is_source(rp, str, len)) {
+		if (last != NULL && last->ptr != NULL &&
+		    last->ptr + last->len == str) {
+			rope_span_save(rp, VECTOR_LENGTH(rp->rp_spans) - 1);
+			last->len += len;
+			return;
+		}
+		if (len >= ROPE_SPAN_MIN) {
+			struct rope_span *sp;
+
+			sp = rope_span_alloc(rp);
+			sp->ptr = str;
+			sp->len = len;
+			return;
+		}
+	}
+
+	off = buffer_get_len(rp->rp_inline);
+	if (buffer_puts(rp->rp_inline, str, len))
+		err(1, NULL);
+	if (last != NULL && last->ptr == NULL && last->off + last->len == off) {
+		rope_span_save(rp, VECTOR_LENGTH(rp->rp_spans) - 1);
+		last->len += len;
+	} else {
+		struct rope_span *sp;
+
+		sp = rope_span_alloc(rp);
+		sp->off = off;
+		sp->len = len;
+	}
+}
+
+void
+rope_putc(struct rope *rp, char ch)
+{
+	rope_puts(rp, &ch, 1);
+}
+
+/*
+ * Remove at most n characters from the end of the rope. Returns the number of
+ * removed characters.
+ */
+size_t
+rope_pop(struct rope *rp, size_t n)
+{
+	size_t npop = 0;
+
+	while (npop < n) {
+		struct rope_span *sp;
+		size_t len;
+
+		sp = VECTOR_LAST(rp->rp_spans);
+		if (sp == NULL)
+			break;
+		rope_span_save(rp, VECTOR_LENGTH(rp->rp_spans) - 1);
+		len = sp->len < n - npop ? sp->len : n - npop;
+		/* Keep the inline buffer tight unless covered by a mark. */
+		if (sp->ptr == NULL &&
+		    sp->off + sp->len == buffer_get_len(rp->rp_inline) &&
+		    sp->off + sp->len - len >= rp->rp_protect.inline_len)
+			buffer_pop(rp->rp_inline, len);
+		sp->len -= len;
+		npop += len;
+		if (sp->len == 0)
+			VECTOR_POP(rp->rp_spans);
+	}
+	rp->rp_len -= npop;
+	return npop;
+}
+
+/*
+ * Get the n:th character counting from the end of the rope, where 1 refers to
+ * the last character. Returns -1 if the rope is too short.
+ */
+int
+rope_back(const struct rope *rp, size_t n)
+{
+	size_t i;
+
+	for (i = VECTOR_LENGTH(rp->rp_spans); i > 0; i--) {
+		const struct rope_span *sp = &rp->rp_spans[i - 1];
+
+		if (n <= sp->len) {
+			const char *str = rope_span_ptr(rp, sp);
+
+			return (unsigned char)str[sp->len - n];
+		}
+		n -= sp->len;
+	}
+	return -1;
+}
+
+void
+rope_mark(struct rope *rp, struct rope_mark *mk)
+{
+	*mk = (struct rope_mark){
+	    .nspans	= VECTOR_LENGTH(rp->rp_spans),
+	    .nundo	= VECTOR_LENGTH(rp->rp_undo),
+	    .inline_len	= buffer_get_len(rp->rp_inline),
+	    .len	= rp->rp_len,
+	};
+	if (mk->nspans > rp->rp_protect.nspans)
+		rp->rp_protect.nspans = mk->nspans;
+	if (mk->inline_len > rp->rp_protect.inline_len)
+		rp->rp_protect.inline_len = mk->inline_len;
+}
+
+/*
+ * Restore the rope to the state at the time the given mark was created. Marks
+ * must be restored in the reverse order of creation.
+ */
+void
+rope_restore(struct rope *rp, const struct rope_mark *mk)
+{
+	size_t inline_len;
+
+	while (VECTOR_LENGTH(rp->rp_spans) > mk->nspans)
+		VECTOR_POP(rp->rp_spans);
+	while (VECTOR_LENGTH(rp->rp_spans) < mk->nspans)
+		rope_span_alloc(rp);
+	/* Favor the oldest copy as it reflects the state at the mark. */
+	while (VECTOR_LENGTH(rp->rp_undo) > mk->nundo) {
+		const struct rope_undo *ud;
+
+		ud = VECTOR_POP(rp->rp_undo);
+		if (ud->idx < mk->nspans)
+			rp->rp_spans[ud->idx] = ud->span;
+	}
+	inline_len = buffer_get_len(rp->rp_inline);
+	if (inline_len > mk->inline_len)
+		buffer_pop(rp->rp_inline, inline_len - mk->inline_len);
+	rp->rp_len = mk->len;
+}
+
+size_t
+rope_get_len(const struct rope *rp)
+{
+	return rp->rp_len;
+}
+
+/*
+ * Returns zero if the rope and buffer are equal.
+ */
+int
+rope_cmp(const struct rope *rp, const struct buffer *bf)
+{
+	const char *buf = buffer_get_ptr(bf);
+	size_t i;
+
+	if (rp->rp_len != buffer_get_len(bf))
+		return 1;
+	for (i = 0; i < VECTOR_LENGTH(rp->rp_spans); i++) {
+		const struct rope_span *sp = &rp->rp_spans[i];
+
+		if (memcmp(rope_span_ptr(rp, sp), buf, sp->len) != 0)
+			return 1;
+		buf += sp->len;
+	}
+	return 0;
+}
+
+void
+rope_flatten(const struct rope *rp, struct buffer *bf)
+{
+	size_t i;
+
+	for (i = 0; i < VECTOR_LENGTH(rp->rp_spans); i++) {
+		const struct rope_span *sp = &rp->rp_spans[i];
+
+		if (buffer_puts(bf, rope_span_ptr(rp, sp), sp->len))
+			err(1, NULL);
+	}
+}
+
+/*
+ * Write the rope to the given file descriptor, batching spans using writev(2).
+ * Returns non-zero on error with errno set.
+ */
+int
+rope_write(const struct rope *rp, int fd)
+{
+	struct iovec iov[IOV_MAX < 256 ? IOV_MAX : 256];
+	size_t niov = sizeof(iov) / sizeof(iov[0]);
+	size_t nspans = VECTOR_LENGTH(rp->rp_spans);
+	size_t i = 0;
+	size_t off = 0;
+
+	while (i < nspans) {
+		size_t j, nw;
+		ssize_t n;
+		int iovcnt = 0;
+
+		for (j = i; j < nspans && (size_t)iovcnt < niov; j++) {
+			const struct rope_span *sp = &rp->rp_spans[j];
+			size_t skip = j == i ? off : 0;
+
+			iov[iovcnt].iov_base =
+			    (void *)(rope_span_ptr(rp, sp) + skip);
+			iov[iovcnt].iov_len = sp->len - skip;
+			iovcnt++;
+		}
+
+		n = writev(fd, iov, iovcnt);
+		if (n == -1)
+			return 1;
+		for (nw = (size_t)n; nw > 0;) {
+			size_t left = rp->rp_spans[i].len - off;
+
+			if (nw < left) {
+				off += nw;
+				nw = 0;
+			} else {
+				nw -= left;
+				off = 0;
+				i++;
+			}
+		}
+	}
+	return 0;
+}
+
+static struct rope_span *
+rope_span_alloc(struct rope *rp)
+{
+	struct rope_span *sp;
+
+	sp = VECTOR_CALLOC(rp->rp_spans);
+	if (sp == NULL)
+		err(1, NULL);
+	return sp;
+}
+
+/*
+ * Save a copy of the given span before it gets modified, only necessary if the
+ * span is covered by a mark.
+ */
+static void
+rope_span_save(struct rope *rp, size_t idx)
+{
+	struct rope_undo *ud;
+
+	if (idx >= rp->rp_protect.nspans)
+		return;
+	ud = VECTOR_ALLOC(rp->rp_undo);
+	if (ud == NULL)
+		err(1, NULL);
+	ud->span = rp->rp_spans[idx];
+	ud->idx = idx;
+}
+
+static const char *
+rope_span_ptr(const struct rope *rp, const struct rope_span *sp)
+{
+	if (sp->ptr != NULL)
+		return sp->ptr;
+	return &buffer_get_ptr(rp->rp_inline)[sp->off];
+}
+
+static int
+rope_is_source(const struct rope *rp, const char *str, size_t len)
+{
+	uintptr_t beg = (uintptr_t)rp->rp_src;
+	uintptr_t p = (uintptr_t)str;
+
+	if (rp->rp_src == NULL)
+		return 0;
+	return p >= beg && len <= rp->rp_srclen &&
+	    p - beg <= rp->rp_srclen - len;
+}
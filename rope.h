@@ -0,0 +1,31 @@
+#include <stddef.h>	/* size_t */
+
+struct buffer;
+
+/*
+ * Position in a rope, used to restore the rope to a previous state.
+ */
+struct rope_mark {
+	size_t	nspans;
+	size_t	nundo;
+	size_t	inline_len;
+	size_t	len;
+};
+
+struct rope	*rope_alloc(const struct buffer *);
+void		 rope_free(struct rope *);
+void		 rope_reset(struct rope *);
+void		 rope_recycle(struct rope *, const struct buffer *);
+
+void	rope_puts(struct rope *, const char *, size_t);
+void	rope_putc(struct rope *, char);
+size_t	rope_pop(struct rope *, size_t);
+int	rope_back(const struct rope *, size_t);
+
+void	rope_mark(struct rope *, struct rope_mark *);
+void	rope_restore(struct rope *, const struct rope_mark *);
+
+size_t	rope_get_len(const struct rope *);
+int	rope_cmp(const struct rope *, const struct buffer *);
+void	rope_flatten(const struct rope *, struct buffer *);
+int	rope_write(const struct rope *, int);
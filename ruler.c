@@ -10,6 +10,7 @@
 #include "libks/vector.h"
 
 #include "doc.h"
+#include "profile.h"
 #include "token.h"
 #include "util.h"
 
@@ -65,8 +66,10 @@ ruler_free(struct ruler *rl)
 		struct ruler_column *rc = VECTOR_POP(rl->rl_columns);
 		size_t i;
 
-		for (i = 0; i < VECTOR_LENGTH(rc->rc_datums); i++)
+		for (i = 0; i < VECTOR_LENGTH(rc->rc_datums); i++) {
 			token_rele(rc->rc_datums[i].rd_tk);
+			profile_free(PROFILE_RULER, sizeof(*rc->rc_datums));
+		}
 		VECTOR_FREE(rc->rc_datums);
 	}
 	VECTOR_FREE(rl->rl_columns);
@@ -100,6 +103,7 @@ ruler_insert0(struct ruler *rl, struct token *tk, struct doc *dc,
 	rd = VECTOR_CALLOC(rc->rc_datums);
 	if (rd == NULL)
 		err(1, NULL);
+	profile_alloc(PROFILE_RULER, "DATUM", fun, lno, sizeof(*rd));
 	rd->rd_dc = doc_alloc0(DOC_ALIGN, dc, 1, fun, lno);
 	token_ref(tk);
 	rd->rd_tk = tk;
@@ -244,8 +248,10 @@ ruler_reset(struct ruler *rl)
 		struct ruler_column *rc = VECTOR_POP(rl->rl_columns);
 		size_t i;
 
-		for (i = 0; i < VECTOR_LENGTH(rc->rc_datums); i++)
+		for (i = 0; i < VECTOR_LENGTH(rc->rc_datums); i++) {
 			token_rele(rc->rc_datums[i].rd_tk);
+			profile_free(PROFILE_RULER, sizeof(*rc->rc_datums));
+		}
 		VECTOR_FREE(rc->rc_datums);
 	}
 	VECTOR_FREE(rl->rl_indent);
@@ -4,6 +4,7 @@
 
 #include <assert.h>
 #include <err.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -29,6 +30,9 @@ struct token_range {
 	    (tvar) = (var) ? token_next((var)) : NULL)
 
 static char	*token_range_str(const struct token_range *);
+static uint32_t	 token_range_hash(const struct token_range *);
+static int	 token_range_eq(const struct token_range *,
+    const struct token_range *);
 
 /*
  * Represents a single declaration from the source code.
@@ -48,15 +52,19 @@ struct decl_var {
 	struct token_range	 dv_ident;
 	struct token		*dv_sort;
 	struct token		*dv_delim;
+	/* Leading bytes of the sort identifier, favored while sorting. */
+	uint64_t		 dv_key;
 };
 
 static int	decl_var_cmp(const struct decl_var *, const struct decl_var *);
+static uint64_t	decl_var_key(const struct token *);
 static int	decl_var_is_empty(const struct decl_var *);
 
 struct decl_type {
 	struct token_range		 dt_tr;
 	VECTOR(struct decl_type_vars)	 dt_slots;
 	char				*dt_str;
+	uint32_t			 dt_hash;
 };
 
 static void			 decl_type_free(struct decl_type *);
@@ -87,6 +95,15 @@ struct simple_decl {
 	/* All seen type declarations. */
 	VECTOR(struct decl_type) types;
 
+	/*
+	 * Open addressing hash table of indices into types, offset by one
+	 * allowing zero to represent an empty entry.
+	 */
+	struct {
+		size_t	*indices;
+		size_t	 size;
+	} index;
+
 	/* Current type declaration. */
 	struct decl_type	*dt;
 
@@ -97,9 +114,9 @@ struct simple_decl {
 };
 
 static struct decl_type	*simple_decl_type_create(struct simple_decl *,
-    const char *, const struct token_range *);
-static struct decl_type	*simple_decl_type_find(struct simple_decl *,
-    const char *);
+    const struct token_range *);
+static size_t		*simple_decl_type_find(struct simple_decl *,
+    const struct token_range *, uint32_t);
 static struct token	*simple_decl_move_vars(struct simple_decl *,
     struct decl_type *, struct decl_type_vars *, struct token *);
 
@@ -200,6 +217,7 @@ simple_decl_free(struct simple_decl *sd)
 		decl_type_free(dt);
 	}
 	VECTOR_FREE(sd->types);
+	free(sd->index.indices);
 
 	free(sd);
 }
@@ -214,7 +232,6 @@ simple_decl_type(struct simple_decl *sd, struct token *beg, struct token *end)
 	struct decl *dc;
 	struct decl_var *dv;
 	struct token *tk, *tmp;
-	char *type;
 
 	TOKEN_RANGE_FOREACH(tk, &tr, tmp) {
 		if (!token_is_moveable(tk))
@@ -228,9 +245,7 @@ simple_decl_type(struct simple_decl *sd, struct token *beg, struct token *end)
 		}
 	}
 
-	type = token_range_str(&tr);
-	sd->dt = simple_decl_type_create(sd, type, &tr);
-	free(type);
+	sd->dt = simple_decl_type_create(sd, &tr);
 
 	dv = simple_decl_var_init(sd);
 	/* Pointer(s) are part of the variable. */
@@ -322,6 +337,57 @@ token_range_str(const struct token_range *tr)
 	return str;
 }
 
+/*
+ * Hash the given range using FNV-1a, ignoring pointers in order to agree with
+ * token_range_eq().
+ */
+static uint32_t
+token_range_hash(const struct token_range *tr)
+{
+	struct token *tk, *tmp;
+	uint32_t h = 2166136261u;
+
+	TOKEN_RANGE_FOREACH(tk, tr, tmp) {
+		size_t i;
+
+		if (tk->tk_type == TOKEN_STAR)
+			continue;
+
+		for (i = 0; i < tk->tk_len; i++) {
+			h ^= (unsigned char)tk->tk_str[i];
+			h *= 16777619u;
+		}
+		/* Token separator. */
+		h ^= ' ';
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/*
+ * Returns non-zero if the given ranges are equal while ignoring pointers.
+ */
+static int
+token_range_eq(const struct token_range *a, const struct token_range *b)
+{
+	struct token *ta = a->tr_beg;
+	struct token *tb = b->tr_beg;
+
+	for (;;) {
+		while (ta != NULL && ta->tk_type == TOKEN_STAR)
+			ta = ta == a->tr_end ? NULL : token_next(ta);
+		while (tb != NULL && tb->tk_type == TOKEN_STAR)
+			tb = tb == b->tr_end ? NULL : token_next(tb);
+		if (ta == NULL || tb == NULL)
+			return ta == tb;
+		if (ta->tk_len != tb->tk_len ||
+		    memcmp(ta->tk_str, tb->tk_str, ta->tk_len) != 0)
+			return 0;
+		ta = ta == a->tr_end ? NULL : token_next(ta);
+		tb = tb == b->tr_end ? NULL : token_next(tb);
+	}
+}
+
 static void
 decl_free(struct decl *dc)
 {
@@ -333,9 +399,29 @@ decl_free(struct decl *dc)
 static int
 decl_var_cmp(const struct decl_var *a, const struct decl_var *b)
 {
+	if (a->dv_key != b->dv_key)
+		return a->dv_key < b->dv_key ? -1 : 1;
 	return token_strcmp(a->dv_sort, b->dv_sort);
 }
 
+/*
+ * Construct a sort key from the leading bytes of the given token, ordered in
+ * the same way as token_strcmp().
+ */
+static uint64_t
+decl_var_key(const struct token *tk)
+{
+	uint64_t key = 0;
+	size_t i;
+
+	for (i = 0; i < sizeof(key); i++) {
+		key <<= 8;
+		if (i < tk->tk_len)
+			key |= (unsigned char)tk->tk_str[i];
+	}
+	return key;
+}
+
 static int
 decl_var_is_empty(const struct decl_var *dv)
 {
@@ -369,21 +455,25 @@ decl_type_slot(struct decl_type *dt, unsigned int n)
  * Create or find the given type.
  */
 static struct decl_type *
-simple_decl_type_create(struct simple_decl *sd, const char *type,
-    const struct token_range *tr)
+simple_decl_type_create(struct simple_decl *sd, const struct token_range *tr)
 {
 	struct decl_type *dt;
 	struct token *end = NULL;
 	struct token *tk, *tmp;
+	size_t *idx;
+	uint32_t hash;
 
-	dt = simple_decl_type_find(sd, type);
-	if (dt != NULL)
-		return dt;
+	hash = token_range_hash(tr);
+	idx = simple_decl_type_find(sd, tr, hash);
+	if (*idx > 0)
+		return &sd->types[*idx - 1];
 
 	dt = VECTOR_CALLOC(sd->types);
 	if (dt == NULL)
 		err(1, NULL);
+	*idx = VECTOR_LENGTH(sd->types);
 	dt->dt_tr = *tr;
+	dt->dt_hash = hash;
 	/* Pointer(s) are not part of the type. */
 	TOKEN_RANGE_FOREACH(tk, tr, tmp) {
 		if (tk->tk_type != TOKEN_STAR)
@@ -394,23 +484,54 @@ simple_decl_type_create(struct simple_decl *sd, const char *type,
 
 	if (VECTOR_INIT(dt->dt_slots))
 		err(1, NULL);
-	dt->dt_str = estrdup(type);
+	dt->dt_str = token_range_str(&dt->dt_tr);
 	simple_trace(sd, "new type \"%s\"", dt->dt_str);
 	return dt;
 }
 
-static struct decl_type *
-simple_decl_type_find(struct simple_decl *sd, const char *type)
+/*
+ * Returns the index table entry for the given type, which is zero if the type
+ * is not present. The table is grown beforehand as the caller might claim the
+ * entry.
+ */
+static size_t *
+simple_decl_type_find(struct simple_decl *sd, const struct token_range *tr,
+    uint32_t hash)
 {
-	size_t i;
+	size_t i, mask;
 
-	for (i = 0; i < VECTOR_LENGTH(sd->types); i++) {
-		struct decl_type *dt = &sd->types[i];
+	if (2 * (VECTOR_LENGTH(sd->types) + 1) > sd->index.size) {
+		size_t *old = sd->index.indices;
+		size_t oldsize = sd->index.size;
+
+		sd->index.size = oldsize > 0 ? 2 * oldsize : 64;
+		sd->index.indices = ecalloc(sd->index.size,
+		    sizeof(*sd->index.indices));
+		mask = sd->index.size - 1;
+		for (i = 0; i < oldsize; i++) {
+			size_t j;
+
+			if (old[i] == 0)
+				continue;
+			for (j = sd->types[old[i] - 1].dt_hash & mask;
+			    sd->index.indices[j] != 0; j = (j + 1) & mask)
+				continue;
+			sd->index.indices[j] = old[i];
+		}
+		free(old);
+	}
+
+	mask = sd->index.size - 1;
+	for (i = hash & mask;; i = (i + 1) & mask) {
+		size_t *idx = &sd->index.indices[i];
+		const struct decl_type *dt;
 
-		if (strcmp(dt->dt_str, type) == 0)
-			return dt;
+		if (*idx == 0)
+			return idx;
+		dt = &sd->types[*idx - 1];
+		if (dt->dt_hash == hash && token_range_eq(&dt->dt_tr, tr))
+			return idx;
 	}
-	return NULL;
 }
 
 static struct token *
@@ -502,6 +623,7 @@ simple_decl_var_end(struct simple_decl *sd, struct token *end)
 			break;
 	}
 	dv->dv_sort = sort;
+	dv->dv_key = decl_var_key(sort);
 
 	dst = VECTOR_CALLOC(ds->vars);
 	if (dst == NULL)
@@ -15,6 +15,7 @@
 #include "doc.h"
 #include "lexer.h"
 #include "options.h"
+#include "rope.h"
 #include "token.h"
 
 struct stmt {
@@ -38,7 +39,7 @@ static struct stmt	*simple_stmt_alloc(struct simple_stmt *, unsigned int,
     unsigned int);
 
 static int	need_braces(struct simple_stmt *, const struct stmt *,
-    struct buffer *);
+    struct rope *, struct buffer *);
 static void	add_braces(struct simple_stmt *);
 static void	remove_braces(struct simple_stmt *);
 
@@ -65,6 +66,7 @@ void
 simple_stmt_leave(struct simple_stmt *ss)
 {
 	struct buffer *bf;
+	struct rope *rp;
 	size_t i;
 	int dobraces = 0;
 
@@ -74,12 +76,13 @@ simple_stmt_leave(struct simple_stmt *ss)
 	bf = buffer_alloc(1024);
 	if (bf == NULL)
 		err(1, NULL);
+	rp = rope_alloc(NULL);
 	for (i = 0; i < VECTOR_LENGTH(ss->ss_stmts); i++) {
 		const struct stmt *st = &ss->ss_stmts[i];
 
 		if (st->st_flags & STMT_IGNORE)
 			continue;
-		if (need_braces(ss, st, bf)) {
+		if (need_braces(ss, st, rp, bf)) {
 			/*
 			 * No point in continuing as at least one statement
 			 * spans over multiple lines.
@@ -88,6 +91,7 @@ simple_stmt_leave(struct simple_stmt *ss)
 			break;
 		}
 	}
+	rope_free(rp);
 	buffer_free(bf);
 
 	if (dobraces)
@@ -203,7 +207,8 @@ is_stmt_empty(const struct simple_stmt *ss, const struct stmt *st)
 }
 
 static int
-need_braces(struct simple_stmt *ss, const struct stmt *st, struct buffer *bf)
+need_braces(struct simple_stmt *ss, const struct stmt *st, struct rope *rp,
+    struct buffer *bf)
 {
 	const char *buf;
 	size_t buflen;
@@ -211,13 +216,15 @@ need_braces(struct simple_stmt *ss, const struct stmt *st, struct buffer *bf)
 	if (is_stmt_empty(ss, st))
 		return 1;
 
-	buffer_reset(bf);
+	rope_reset(rp);
 	doc_exec(&(struct doc_exec_arg){
 	    .dc	= st->st_root,
-	    .bf	= bf,
+	    .rp	= rp,
 	    .st	= ss->ss_st,
 	    .op	= ss->ss_op,
 	});
+	buffer_reset(bf);
+	rope_flatten(rp, bf);
 	buflen = buffer_get_len(bf);
 	buf = strtrim(buffer_get_ptr(bf), &buflen);
 	if (isoneline(buf, buflen)) {
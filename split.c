@@ -0,0 +1,346 @@
+#include "split.h"
+
+#include "config.h"
+
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libks/buffer.h"
+
+#include "alloc.h"
+#include "clang.h"
+#include "lexer.h"
+#include "options.h"
+#include "parser.h"
+#include "rope.h"
+#include "simple.h"
+#include "token.h"
+
+struct segment {
+	const char		*sg_path;
+	const struct style	*sg_st;
+	const struct options	*sg_op;
+	struct buffer		*sg_src;
+	struct buffer		*sg_dst;
+	pthread_t		 sg_thread;
+	int			 sg_error;
+};
+
+static void	*segment_thread(void *);
+static int	 segment_format(struct segment *);
+
+static size_t	skip_comment(const char *, size_t, size_t);
+static size_t	skip_cpp(const char *, size_t, size_t, int *);
+static size_t	skip_literal(const char *, size_t, size_t);
+
+/*
+ * Find the ranges of the given source code which can be formatted
+ * independently, each one spanning at least the given number of bytes. A range
+ * can only end with a right brace in the first column closing a top level
+ * declaration outside of any cpp branch, followed by a blank line. The blank
+ * lines separating two ranges are not covered by any range. Returns the number
+ * of ranges, which is always at least one.
+ *
+ * The source code is not lexed but rather scanned for comments, literals and
+ * cpp directives, favoring speed over accuracy. A bogus range is expected to
+ * be rejected by the parser.
+ */
+size_t
+split_find(const char *buf, size_t len, size_t minsiz,
+    struct split_range *ranges, size_t nranges)
+{
+	size_t beg = 0;
+	size_t i = 0;
+	size_t n = 0;
+	int depth = 0;
+	int cpp = 0;
+	int bol = 1;
+
+	while (i < len && n + 1 < nranges) {
+		if (bol) {
+			size_t j = i;
+
+			while (j < len && (buf[j] == ' ' || buf[j] == '\t'))
+				j++;
+			if (j < len && buf[j] == '#') {
+				i = skip_cpp(buf, len, j, &cpp);
+				continue;
+			}
+		}
+
+		switch (buf[i]) {
+		case '\n':
+			bol = 1;
+			i++;
+			continue;
+
+		case '{':
+			depth++;
+			break;
+
+		case '}':
+			if (bol && depth == 1 && cpp == 0 &&
+			    len - i > 2 && buf[i + 1] == '\n' &&
+			    buf[i + 2] == '\n' && i + 2 - beg >= minsiz) {
+				size_t nx = i + 2;
+
+				while (nx < len && buf[nx] == '\n')
+					nx++;
+				if (nx < len) {
+					ranges[n].sr_beg = beg;
+					ranges[n].sr_end = i + 2;
+					n++;
+					beg = nx;
+				}
+			}
+			if (depth > 0)
+				depth--;
+			break;
+
+		case '"':
+		case '\'':
+			bol = 0;
+			i = skip_literal(buf, len, i);
+			continue;
+
+		case '/':
+			if (len - i > 1 && buf[i + 1] == '*') {
+				bol = 0;
+				i = skip_comment(buf, len, i);
+				continue;
+			}
+			if (len - i > 1 && buf[i + 1] == '/') {
+				const char *nl;
+
+				nl = memchr(&buf[i], '\n', len - i);
+				i = nl != NULL ? (size_t)(nl - buf) : len;
+				continue;
+			}
+			break;
+
+		default:
+			break;
+		}
+		bol = 0;
+		i++;
+	}
+
+	ranges[n].sr_beg = beg;
+	ranges[n].sr_end = len;
+	return n + 1;
+}
+
+/*
+ * Format the given source code by splitting it into ranges, see split_find(),
+ * formatted concurrently. Returns NULL if the source code could not be split
+ * or if any range could not be formatted on its own, the whole source code is
+ * then expected to be formatted by the caller.
+ */
+struct rope *
+split_exec(const struct buffer *src, const char *path,
+    const struct style *st, const struct options *op)
+{
+	struct split_range *ranges;
+	struct segment *segments;
+	struct options sop = *op;
+	struct rope *rp = NULL;
+	const char *buf = buffer_get_ptr(src);
+	size_t len = buffer_get_len(src);
+	size_t nthreads = 0;
+	size_t i, minsiz, n;
+	int error = 0;
+
+	if (op->op_jobs < 2 || op->diffparse || op->op_tracemask != 0 ||
+	    op->op_memlimit > 0 || len < 2 * SPLIT_MIN_SIZE)
+		return NULL;
+
+	minsiz = len / op->op_jobs;
+	if (minsiz < SPLIT_MIN_SIZE)
+		minsiz = SPLIT_MIN_SIZE;
+	ranges = ecalloc(op->op_jobs, sizeof(*ranges));
+	n = split_find(buf, len, minsiz, ranges, op->op_jobs);
+	if (n < 2) {
+		free(ranges);
+		return NULL;
+	}
+
+	/*
+	 * A range which cannot be parsed must not be recovered as the whole
+	 * source code might parse just fine.
+	 */
+	sop.recover = 0;
+	segments = ecalloc(n, sizeof(*segments));
+	for (i = 0; i < n; i++) {
+		struct segment *sg = &segments[i];
+		size_t siz = ranges[i].sr_end - ranges[i].sr_beg;
+
+		sg->sg_path = path;
+		sg->sg_st = st;
+		sg->sg_op = &sop;
+		sg->sg_src = buffer_alloc(siz + 1);
+		if (sg->sg_src == NULL ||
+		    buffer_puts(sg->sg_src, &buf[ranges[i].sr_beg], siz))
+			err(1, NULL);
+		sg->sg_dst = buffer_alloc(siz + 1);
+		if (sg->sg_dst == NULL)
+			err(1, NULL);
+	}
+	/* The first range is formatted by the calling thread. */
+	for (i = 1; i < n; i++) {
+		struct segment *sg = &segments[i];
+
+		errno = pthread_create(&sg->sg_thread, NULL, segment_thread,
+		    sg);
+		if (errno) {
+			warn("pthread_create");
+			error = 1;
+			break;
+		}
+		nthreads++;
+	}
+	if (!error && segment_format(&segments[0]))
+		error = 1;
+	for (i = 1; i <= nthreads; i++) {
+		struct segment *sg = &segments[i];
+
+		errno = pthread_join(sg->sg_thread, NULL);
+		if (errno)
+			err(1, "pthread_join");
+		if (sg->sg_error)
+			error = 1;
+	}
+
+	if (!error) {
+		rp = rope_alloc(src);
+		for (i = 0; i < n; i++) {
+			const struct buffer *dst = segments[i].sg_dst;
+
+			/* Declarations are separated by exactly one blank line. */
+			if (i > 0)
+				rope_putc(rp, '\n');
+			rope_puts(rp, buffer_get_ptr(dst), buffer_get_len(dst));
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		buffer_free(segments[i].sg_dst);
+		buffer_free(segments[i].sg_src);
+	}
+	free(segments);
+	free(ranges);
+	return rp;
+}
+
+static void *
+segment_thread(void *arg)
+{
+	struct segment *sg = arg;
+
+	sg->sg_error = segment_format(sg);
+	return NULL;
+}
+
+static int
+segment_format(struct segment *sg)
+{
+	const struct options *op = sg->sg_op;
+	struct simple *si;
+	struct clang *cl;
+	struct lexer *lx;
+	struct parser *pr = NULL;
+	struct rope *dst;
+	int error = 1;
+
+	si = simple_alloc(op);
+	cl = clang_alloc(sg->sg_st, si, op);
+	lx = lexer_alloc(&(const struct lexer_arg){
+	    .path	= sg->sg_path,
+	    .bf		= sg->sg_src,
+	    .op		= op,
+	    .callbacks	= {
+		.read		= clang_read,
+		.alloc		= token_alloc,
+		.serialize	= token_serialize,
+		.arg		= cl,
+	    },
+	});
+	if (lx == NULL)
+		goto out;
+	pr = parser_alloc(lx, sg->sg_st, si, op);
+	dst = parser_exec(pr, NULL, sg->sg_src);
+	if (dst == NULL)
+		goto out;
+	rope_flatten(dst, sg->sg_dst);
+	error = 0;
+
+out:
+	parser_free(pr);
+	lexer_free(lx);
+	clang_free(cl);
+	simple_free(si);
+	return error;
+}
+
+static size_t
+skip_comment(const char *buf, size_t len, size_t i)
+{
+	for (i += 2; i < len; i++) {
+		if (buf[i] == '*' && len - i > 1 && buf[i + 1] == '/')
+			return i + 2;
+	}
+	return len;
+}
+
+/*
+ * Skip the cpp directive at the given offset, including line continuations,
+ * keeping track of the nesting of conditional directives.
+ */
+static size_t
+skip_cpp(const char *buf, size_t len, size_t i, int *cpp)
+{
+	size_t beg;
+
+	for (i++; i < len && (buf[i] == ' ' || buf[i] == '\t'); i++)
+		continue;
+	beg = i;
+	while (i < len && buf[i] >= 'a' && buf[i] <= 'z')
+		i++;
+	if ((i - beg == 2 && strncmp(&buf[beg], "if", 2) == 0) ||
+	    (i - beg == 5 && strncmp(&buf[beg], "ifdef", 5) == 0) ||
+	    (i - beg == 6 && strncmp(&buf[beg], "ifndef", 6) == 0))
+		(*cpp)++;
+	else if (i - beg == 5 && strncmp(&buf[beg], "endif", 5) == 0 &&
+	    *cpp > 0)
+		(*cpp)--;
+
+	while (i < len) {
+		if (buf[i] == '\\' && len - i > 1 && buf[i + 1] == '\n')
+			i += 2;
+		else if (buf[i] == '/' && len - i > 1 && buf[i + 1] == '*')
+			i = skip_comment(buf, len, i);
+		else if (buf[i] == '\n')
+			return i + 1;
+		else
+			i++;
+	}
+	return len;
+}
+
+static size_t
+skip_literal(const char *buf, size_t len, size_t i)
+{
+	char delim = buf[i];
+
+	for (i++; i < len; i++) {
+		if (buf[i] == '\\')
+			i++;
+		else if (buf[i] == delim)
+			return i + 1;
+		else if (buf[i] == '\n')
+			return i;
+	}
+	return len;
+}
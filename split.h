@@ -0,0 +1,19 @@
+#include <stddef.h>	/* size_t */
+
+struct buffer;
+struct options;
+struct rope;
+struct style;
+
+/* Minimum size of a segment formatted by a separate thread. */
+#define SPLIT_MIN_SIZE	(1 << 16)
+
+struct split_range {
+	size_t	sr_beg;
+	size_t	sr_end;
+};
+
+size_t		 split_find(const char *, size_t, size_t, struct split_range *,
+    size_t);
+struct rope	*split_exec(const struct buffer *, const char *,
+    const struct style *, const struct options *);
@@ -5,6 +5,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <err.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -12,6 +13,8 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <sys/stat.h>
+
 #include "libks/arithmetic.h"
 #include "libks/buffer.h"
 #include "libks/compiler.h"
@@ -60,6 +63,33 @@ struct style {
 	} st_options[Last];
 };
 
+/*
+ * Directory with a resolved style, either from a .clang-format file in the
+ * directory itself or any of its ancestors.
+ */
+struct style_dir {
+	const struct style	*st;
+	dev_t			 dev;
+	ino_t			 ino;
+};
+
+struct style_cache {
+	/* Style used if no .clang-format file is found or given explicitly. */
+	struct style			*sc_fallback;
+	/* All parsed .clang-format files. */
+	VECTOR(struct style *)		 sc_styles;
+	/* Directories traversed by the current lookup. */
+	VECTOR(struct style_dir)	 sc_visited;
+	/* Open addressing hash table of directories keyed by inode. */
+	struct style_dir		*sc_dirs;
+	size_t				 sc_size;
+	size_t				 sc_len;
+	const struct options		*sc_op;
+	int				 sc_explicit;
+};
+
+static struct style_dir	*style_cache_dir(struct style_cache *, dev_t, ino_t);
+
 struct style_option {
 	int		 so_scope;
 	const char	*so_key;
@@ -317,6 +347,149 @@ style_free(struct style *st)
 	free(st);
 }
 
+/*
+ * Allocate a cache of styles resolved per directory. If the given path is not
+ * NULL, the same style is used for all files.
+ */
+struct style_cache *
+style_cache_alloc(const char *path, const struct options *op)
+{
+	struct style_cache *sc;
+
+	sc = ecalloc(1, sizeof(*sc));
+	if (VECTOR_INIT(sc->sc_styles))
+		err(1, NULL);
+	if (VECTOR_INIT(sc->sc_visited))
+		err(1, NULL);
+	sc->sc_op = op;
+	if (path != NULL) {
+		sc->sc_fallback = style_parse(path, op);
+		sc->sc_explicit = 1;
+	} else {
+		sc->sc_fallback = style_parse_buffer(NULL, NULL, op);
+	}
+	return sc;
+}
+
+void
+style_cache_free(struct style_cache *sc)
+{
+	if (sc == NULL)
+		return;
+
+	while (!VECTOR_EMPTY(sc->sc_styles))
+		style_free(*VECTOR_POP(sc->sc_styles));
+	VECTOR_FREE(sc->sc_styles);
+	VECTOR_FREE(sc->sc_visited);
+	style_free(sc->sc_fallback);
+	free(sc->sc_dirs);
+	free(sc);
+}
+
+/*
+ * Get the style for the given file, honoring the first .clang-format file
+ * found in the directory of the file or any of its ancestors. A NULL path
+ * refers to the current directory. Each traversed directory remembers the
+ * outcome, causing each .clang-format file to only be parsed once and any
+ * subsequent lookup to stop at the first already traversed directory.
+ */
+const struct style *
+style_cache_get(struct style_cache *sc, const char *path)
+{
+	struct buffer *bf;
+	const struct style *st = NULL;
+	const char *slash;
+	size_t dirlen, i;
+	int flags = O_RDONLY | O_CLOEXEC;
+	int nlevels = 0;
+	int dirfd;
+
+	if (sc->sc_explicit)
+		return sc->sc_fallback;
+
+	slash = path != NULL ? strrchr(path, '/') : NULL;
+	/* Preserve the root directory. */
+	dirlen = slash == NULL ? 0 : (size_t)(slash - path) + 1;
+	bf = buffer_alloc(PATH_MAX);
+	if (bf == NULL)
+		err(1, NULL);
+	buffer_puts(bf, dirlen > 0 ? path : ".", dirlen > 0 ? dirlen : 1);
+	buffer_putc(bf, '\0');
+	dirfd = open(buffer_get_ptr(bf), flags | O_DIRECTORY);
+	buffer_reset(bf);
+	if (dirlen > 0)
+		buffer_puts(bf, path, dirlen);
+
+	VECTOR_CLEAR(sc->sc_visited);
+	while (dirfd != -1) {
+		struct style_dir *sd;
+		struct stat sb;
+		int fd;
+
+		if (fstat(dirfd, &sb) == -1)
+			break;
+		sd = style_cache_dir(sc, sb.st_dev, sb.st_ino);
+		if (sd->st != NULL) {
+			st = sd->st;
+			break;
+		}
+		/* Reached the root directory. */
+		if (nlevels > 0 &&
+		    sb.st_dev == VECTOR_LAST(sc->sc_visited)->dev &&
+		    sb.st_ino == VECTOR_LAST(sc->sc_visited)->ino)
+			break;
+
+		sd = VECTOR_ALLOC(sc->sc_visited);
+		if (sd == NULL)
+			err(1, NULL);
+		sd->dev = sb.st_dev;
+		sd->ino = sb.st_ino;
+
+		fd = openat(dirfd, ".clang-format", flags);
+		if (fd != -1) {
+			struct buffer *src;
+			struct style **dst;
+
+			buffer_printf(bf, ".clang-format");
+			buffer_putc(bf, '\0');
+			src = buffer_read_fd(fd);
+			close(fd);
+			dst = VECTOR_ALLOC(sc->sc_styles);
+			if (dst == NULL)
+				err(1, NULL);
+			*dst = style_parse_buffer(src, buffer_get_ptr(bf),
+			    sc->sc_op);
+			buffer_free(src);
+			if (trace(sc->sc_op, 's') >= 2)
+				style_dump(*dst);
+			st = *dst;
+			break;
+		}
+
+		fd = openat(dirfd, "..", flags | O_DIRECTORY);
+		close(dirfd);
+		dirfd = fd;
+		buffer_printf(bf, "../");
+		nlevels++;
+	}
+	if (dirfd != -1)
+		close(dirfd);
+	buffer_free(bf);
+
+	if (st == NULL)
+		st = sc->sc_fallback;
+	for (i = 0; i < VECTOR_LENGTH(sc->sc_visited); i++) {
+		const struct style_dir *visited = &sc->sc_visited[i];
+		struct style_dir *sd;
+
+		sd = style_cache_dir(sc, visited->dev, visited->ino);
+		if (sd->st == NULL)
+			sc->sc_len++;
+		sd->st = st;
+	}
+	return st;
+}
+
 unsigned int
 style(const struct style *st, int option)
 {
@@ -897,3 +1070,43 @@ style_keyword_str(enum style_keyword keyword)
 	}
 	return "Unknown";
 }
+
+/*
+ * Returns the hash table entry for the given directory, claimed by assigning a
+ * style to it. The table is grown beforehand as the caller might claim the
+ * entry.
+ */
+static struct style_dir *
+style_cache_dir(struct style_cache *sc, dev_t dev, ino_t ino)
+{
+	size_t i, mask;
+
+	if (2 * (sc->sc_len + 1) > sc->sc_size) {
+		struct style_dir *old = sc->sc_dirs;
+		size_t oldsize = sc->sc_size;
+
+		sc->sc_size = oldsize > 0 ? 2 * oldsize : 64;
+		sc->sc_dirs = ecalloc(sc->sc_size, sizeof(*sc->sc_dirs));
+		sc->sc_len = 0;
+		for (i = 0; i < oldsize; i++) {
+			if (old[i].st == NULL)
+				continue;
+			*style_cache_dir(sc, old[i].dev, old[i].ino) = old[i];
+			sc->sc_len++;
+		}
+		free(old);
+	}
+
+	mask = sc->sc_size - 1;
+	for (i = ((size_t)ino * 31 + (size_t)dev) & mask;; i = (i + 1) & mask) {
+		struct style_dir *sd = &sc->sc_dirs[i];
+
+		if (sd->st == NULL) {
+			sd->dev = dev;
+			sd->ino = ino;
+			return sd;
+		}
+		if (sd->dev == dev && sd->ino == ino)
+			return sd;
+	}
+}
@@ -1,6 +1,7 @@
 struct buffer;
 struct options;
 struct style;
+struct style_cache;
 
 /* Supported clang format options and values. */
 #define FOR_STYLES(OP)							\
@@ -93,6 +94,11 @@ struct style	*style_parse_buffer(const struct buffer *, const char *,
     const struct options *);
 void		 style_free(struct style *);
 
+struct style_cache	*style_cache_alloc(const char *,
+    const struct options *);
+void			 style_cache_free(struct style_cache *);
+const struct style	*style_cache_get(struct style_cache *, const char *);
+
 unsigned int	style(const struct style *, int);
 int		style_brace_wrapping(const struct style *, int);
 
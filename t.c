@@ -14,13 +14,16 @@
 #include "expr.h"
 #include "fs.h"
 #include "lexer.h"
+#include "libknfmt.h"
 #include "options.h"
 #include "parser-attributes.h"
 #include "parser-expr.h"
 #include "parser-priv.h"
 #include "parser-type.h"
 #include "parser.h"
+#include "rope.h"
 #include "simple.h"
+#include "split.h"
 #include "style.h"
 #include "token.h"
 #include "util.h"
@@ -67,6 +70,11 @@ static int	test_parser_attributes_peek0(struct context *, const char *,
 static int	test_lexer_read0(struct context *, const char *, const char *,
     int);
 
+#define test_lexer_edit(a, b, c, d) \
+	test(test_lexer_edit0(cx, (a), (b), (c), (d), __LINE__))
+static int	test_lexer_edit0(struct context *, const char *, size_t,
+    size_t, const char *, int);
+
 struct test_token_move {
 	const char	*src;
 	int		 target;
@@ -87,14 +95,43 @@ static int	test_token_position_after0(struct context *,
 	test(test_style0(cx, (a), (b), (c), __LINE__))
 static int	test_style0(struct context *, const char *, int, int, int);
 
+#define test_rope_restore(a, b, c) \
+	test(test_rope_restore0((a), (b), (c), __LINE__))
+static int	test_rope_restore0(const char *, const char *, size_t, int);
+
 #define test_strwidth(a, b, c) \
 	test(test_strwidth0((a), (b), (c), __LINE__))
 static int	test_strwidth0(const char *, size_t, size_t, int);
 
+#define test_colwidth(a, b, c, d) \
+	test(test_colwidth0((a), (b), (c), (d), __LINE__))
+static int	test_colwidth0(const char *, unsigned int, unsigned int,
+    unsigned int, int);
+
+#define test_split_find(a, b) \
+	test(test_split_find0((a), (b), __LINE__))
+static int	test_split_find0(const char *, const char *, int);
+
 #define test_tmptemplate(a, b) \
 	test(test_tmptemplate0((a), (b), __LINE__))
 static int	test_tmptemplate0(const char *, const char *, int);
 
+#define test_knfmt_format(a, b, c, d) \
+	test(test_knfmt_format0((a), (b), (c), (d), __LINE__))
+static int	test_knfmt_format0(const char *, unsigned int, const char *,
+    const char *, int);
+
+#define test_knfmt_changes(a, b, c, d, e) \
+	test(test_knfmt_changes0((a), (b), (c), (d), (e), __LINE__))
+static int	test_knfmt_changes0(const char *, size_t, size_t, const char *,
+    const char *, int);
+
+#define test_knfmt_changes_twice(a, b, c, d, e, f, g, h)		\
+	test(test_knfmt_changes_twice0((a), (b), (c), (d), (e), (f),	\
+	    (g), (h), __LINE__))
+static int	test_knfmt_changes_twice0(const char *, size_t, size_t,
+    const char *, size_t, size_t, const char *, const char *, int);
+
 struct context {
 	struct options	 op;
 	struct buffer	*bf;
@@ -117,6 +154,9 @@ static int	assert_token_move(struct lexer *, const char **, const char *,
 static int	find_token(struct lexer *, int, struct token **);
 
 static char	*tokens_concat(struct lexer *, const struct token *);
+static char	*tokens_dump(struct lexer *);
+static void	 token_dump(struct buffer *, const struct token *,
+    const char *);
 
 int
 main(int argc, char *argv[])
@@ -346,6 +386,43 @@ main(int argc, char *argv[])
 	    },
 	}));
 
+	test_lexer_edit("int a;\nint b;\nint c;\n",
+	    7, 5, "long b");
+	test_lexer_edit("int a;\nint b;\nint c;\n",
+	    14, 5, "int x;\nint c");
+	test_lexer_edit("int a;\nint b;\nint c;\n",
+	    7, 7, "");
+	test_lexer_edit("int a;\nint b;\n",
+	    0, 0, "int z;\n");
+	test_lexer_edit("int a;\nint b;\n",
+	    14, 0, "int c;\n");
+	test_lexer_edit("int a;\nint b;\n",
+	    6, 1, "");
+	test_lexer_edit("int a;\n\nint b;\n",
+	    6, 2, "\n\n\n");
+	test_lexer_edit("int x;\n#if A\nint a;\n#else\nint b;\n#endif\nint c;\n",
+	    13, 5, "long a");
+	test_lexer_edit("int x;\n#if A\nint a;\n#endif\nint c;\n",
+	    20, 7, "");
+	test_lexer_edit("int x;\nint a;\nint c;\n",
+	    7, 7, "#if A\nint a;\n#endif\n");
+	test_lexer_edit("int x;\n#if A\nint a;\nint c;\n",
+	    20, 5, "#endif\nint c");
+	test_lexer_edit("int a;\n/*\n * b\n */\nint c;\n",
+	    10, 4, " * bb\n * b");
+	test_lexer_edit("int a;\nint b;\nint c;\n",
+	    7, 6, "/* int b;");
+	test_lexer_edit("int a; // x\n// y\nint b;\n",
+	    12, 4, "int c;");
+	test_lexer_edit("int a; \\\nint b;\nint c;\n",
+	    9, 5, "long b");
+	test_lexer_edit("int a;\nint b;\nint c;\n",
+	    11, 6, "b; \\\nint");
+	test_lexer_edit("#define A \\\n\t1\nint b;\n",
+	    13, 1, "2");
+	test_lexer_edit("#include <b.h>\n#include <a.h>\nint c;\n",
+	    25, 3, "c.h");
+
 	test_lexer_move_before((&(struct test_token_move){
 	    .src	= "int static x;",
 	    .target	= TOKEN_INT,
@@ -414,20 +491,73 @@ main(int argc, char *argv[])
 	test_style("ColumnLimit: '100'\nColumnLimit: 200", ColumnLimit, 200);
 	test_style("UseTab: 'Never'\nColumnLimit: '100'", ColumnLimit, 100);
 
+	test_rope_restore("static const int x = 1;", " \t", 1);
+	test_rope_restore("static const int x = 1;", " \t", 5);
+	test_rope_restore("static const int x = 1;", "", 3);
+
 	test_strwidth("int", 0, 3);
 	test_strwidth("int\tx", 0, 9);
 	test_strwidth("int\tx", 3, 9);
 	test_strwidth("int\nx", 0, 1);
 	test_strwidth("int\n", 0, 0);
+	test_strwidth("unsigned long long", 0, 18);
+	test_strwidth("unsigned long\tlong", 0, 20);
+	test_strwidth("unsigned\tlong long", 0, 25);
+	test_strwidth("unsigned long long\n\tint", 5, 11);
+	test_strwidth("/*\n * unsigned long long\n */", 0, 3);
+
+	test_colwidth("int", 1, 4, 0);
+	test_colwidth("int\tx", 1, 10, 0);
+	test_colwidth("int\nx", 1, 2, 1);
+	test_colwidth("unsigned long long", 1, 19, 0);
+	test_colwidth("unsigned long\tlong", 1, 21, 0);
+	test_colwidth("/*\n * unsigned long long\n */", 1, 4, 2);
+	test_colwidth("\tunsigned long long\n\t\tint", 1, 20, 1);
+
+	test_split_find("int\nf(void)\n{\n}\n\nint x;\n", "0-16 17-24");
+	test_split_find("int\nf(void)\n{\n}\n\n\nint x;\n", "0-16 18-25");
+	test_split_find("int\nf(void)\n{\n}\nint x;\n", "0-23");
+	test_split_find("int\nf(void)\n{\n}\n\n", "0-17");
+	test_split_find("#if A\nint\nf(void)\n{\n}\n\n#endif\n", "0-30");
+	test_split_find("#define A \\\n}\n\nint x;\n", "0-22");
+	test_split_find("/*\n}\n\n*/\nint x;\n", "0-16");
+	test_split_find("int\nf(void)\n{\n\"{\";\n}\n\nint x;\n",
+	    "0-21 22-29");
 
 	test_tmptemplate("file.c", ".file.c.XXXXXXXX");
 	test_tmptemplate("/file.c", "/.file.c.XXXXXXXX");
 	test_tmptemplate("/root/file.c", "/root/.file.c.XXXXXXXX");
 
+	test_knfmt_format(NULL, 0,
+	    "int main(void){return 0;}\n",
+	    "int\nmain(void)\n{\n\treturn 0;\n}\n");
+	test_knfmt_format("UseTab: Never\nIndentWidth: 4\n", 0,
+	    "int\nmain(void)\n{\n\treturn 0;\n}\n",
+	    "int\nmain(void)\n{\n    return 0;\n}\n");
+	test_knfmt_format(NULL, KNFMT_SIMPLE,
+	    "int\nmain(void)\n{\n\treturn (0);\n}\n",
+	    "int\nmain(void)\n{\n\treturn 0;\n}\n");
+	test_knfmt_format(NULL, 0, "int main(void) {", NULL);
+
+	test_knfmt_changes("int x  =  1;\n\nint\nmain(void)\n{\n\treturn 0;\n}\n",
+	    31, 0, "\tf( 1 );\n",
+	    "int x  =  1;\n\nint\nmain(void)\n{\n\tf(1);\n\treturn 0;\n}\n");
+	test_knfmt_changes("int x  =  1;\n\nint y  =  2;\n",
+	    14, 12, "int z=3;",
+	    "int x  =  1;\n\nint z = 3;\n");
+	test_knfmt_changes("int x;\n", 7, 1, "", NULL);
+	test_knfmt_changes_twice("int x  =  1;\n\nint y  =  2;\n",
+	    14, 12, "int z=3;",
+	    0, 12, "int w=4;",
+	    "int w = 4;\n\nint z = 3;\n");
+	test_knfmt_changes_twice("int x  =  1;\n\nint y  =  2;\n",
+	    14, 12, "int z=3;",
+	    25, 0, "int v=5;\n",
+	    "int x  =  1;\n\nint z = 3;\nint v = 5;\n");
+
 out:
 	context_free(cx);
 	style_shutdown();
-	expr_shutdown();
 	clang_shutdown();
 	return error;
 }
@@ -443,6 +573,7 @@ static int
 test_parser_expr0(struct context *cx, const char *src, const char *exp, int lno)
 {
 	struct buffer *bf = NULL;
+	struct rope *rp = NULL;
 	struct doc *concat, *expr;
 	const char *act;
 	int error;
@@ -464,12 +595,14 @@ test_parser_expr0(struct context *cx, const char *src, const char *exp, int lno)
 	bf = buffer_alloc(128);
 	if (bf == NULL)
 		err(1, NULL);
+	rp = rope_alloc(NULL);
 	doc_exec(&(struct doc_exec_arg){
 	    .dc	= concat,
-	    .bf	= bf,
+	    .rp	= rp,
 	    .st	= cx->st,
 	    .op	= &cx->op,
 	});
+	rope_flatten(rp, bf);
 	buffer_putc(bf, '\0');
 	act = buffer_get_ptr(bf);
 	if (strcmp(exp, act) != 0) {
@@ -480,6 +613,7 @@ test_parser_expr0(struct context *cx, const char *src, const char *exp, int lno)
 
 out:
 	doc_free(concat);
+	rope_free(rp);
 	buffer_free(bf);
 	return error;
 }
@@ -604,6 +738,63 @@ test_lexer_read0(struct context *cx, const char *src, const char *exp,
 	return error;
 }
 
+static int
+test_lexer_edit0(struct context *cx, const char *src, size_t off,
+    size_t rmlen, const char *ins, int lno)
+{
+	struct buffer *bf;
+	struct lexer *lx;
+	char *act = NULL;
+	char *exp = NULL;
+	size_t inslen = strlen(ins);
+	size_t srclen = strlen(src);
+	int error = 0;
+
+	context_init(cx, src);
+
+	bf = buffer_alloc(128);
+	if (bf == NULL)
+		err(1, NULL);
+	buffer_puts(bf, src, off);
+	buffer_puts(bf, ins, inslen);
+	buffer_puts(bf, &src[off + rmlen], srclen - off - rmlen);
+	if (lexer_edit(cx->lx, bf, NULL, off, rmlen, inslen))
+		errx(1, "lexer_edit:%d: failed", lno);
+	act = tokens_dump(cx->lx);
+
+	/* Compare against lexing the edited source from scratch. */
+	lx = lexer_alloc(&(const struct lexer_arg){
+	    .path	= "test.c",
+	    .bf		= bf,
+	    .op		= &cx->op,
+	    .callbacks	= {
+		.read		= clang_read,
+		.alloc		= token_alloc,
+		.serialize	= token_serialize,
+		.arg		= cx->cl,
+	    },
+	});
+	if (lx == NULL)
+		errx(1, "lexer_edit:%d: lexer_alloc failed", lno);
+	exp = tokens_dump(lx);
+	if (strcmp(exp, act) != 0) {
+		fprintf(stderr, "lexer_edit:%d:\n\texp\n%s\n\tgot\n%s\n",
+		    lno, exp, act);
+		error = 1;
+	}
+
+	/* The lexer under test must be freed before its buffer. */
+	parser_free(cx->pr);
+	cx->pr = NULL;
+	lexer_free(cx->lx);
+	cx->lx = NULL;
+	lexer_free(lx);
+	buffer_free(bf);
+	free(exp);
+	free(act);
+	return error;
+}
+
 static int
 test_lexer_move_before0(struct context *cx, struct test_token_move *arg,
     int lno)
@@ -699,6 +890,60 @@ test_style0(struct context *cx, const char *src, int key, int exp, int lno)
 	return error;
 }
 
+static int
+test_rope_restore0(const char *src, const char *suffix, size_t npop, int lno)
+{
+	struct rope_mark mk;
+	struct buffer *act, *exp, *srcbf;
+	struct rope *rp;
+	size_t srclen = strlen(src);
+	int error = 0;
+
+	srcbf = buffer_alloc(128);
+	act = buffer_alloc(128);
+	exp = buffer_alloc(128);
+	if (srcbf == NULL || act == NULL || exp == NULL)
+		err(1, NULL);
+	buffer_puts(srcbf, src, srclen);
+
+	/* Source span followed by an inline span. */
+	rp = rope_alloc(srcbf);
+	rope_puts(rp, buffer_get_ptr(srcbf), srclen);
+	rope_puts(rp, suffix, strlen(suffix));
+	rope_mark(rp, &mk);
+
+	rope_pop(rp, npop);
+	rope_putc(rp, '\n');
+	buffer_puts(exp, src, srclen);
+	buffer_puts(exp, suffix, strlen(suffix));
+	buffer_pop(exp, npop);
+	buffer_putc(exp, '\n');
+	rope_flatten(rp, act);
+	if (buffer_cmp(exp, act) != 0 || rope_cmp(rp, exp) != 0) {
+		fprintf(stderr, "rope_pop:%d: unexpected rope\n", lno);
+		error = 1;
+		goto out;
+	}
+
+	rope_restore(rp, &mk);
+	buffer_reset(act);
+	buffer_reset(exp);
+	buffer_puts(exp, src, srclen);
+	buffer_puts(exp, suffix, strlen(suffix));
+	rope_flatten(rp, act);
+	if (buffer_cmp(exp, act) != 0 || rope_cmp(rp, exp) != 0) {
+		fprintf(stderr, "rope_restore:%d: unexpected rope\n", lno);
+		error = 1;
+	}
+
+out:
+	rope_free(rp);
+	buffer_free(exp);
+	buffer_free(act);
+	buffer_free(srcbf);
+	return error;
+}
+
 static int
 test_strwidth0(const char *str, size_t pos, size_t exp, int lno)
 {
@@ -713,6 +958,149 @@ test_strwidth0(const char *str, size_t pos, size_t exp, int lno)
 	return 0;
 }
 
+static int
+test_colwidth0(const char *str, unsigned int cno, unsigned int exp,
+    unsigned int explno, int lno)
+{
+	unsigned int actlno = 0;
+	unsigned int act;
+
+	act = colwidth(str, strlen(str), cno, &actlno);
+	if (exp != act || explno != actlno) {
+		fprintf(stderr, "colwidth:%d:\n\texp %u:%u\n\tgot %u:%u\n",
+		    lno, explno, exp, actlno, act);
+		return 1;
+	}
+	return 0;
+}
+
+static int
+test_split_find0(const char *src, const char *exp, int lno)
+{
+	char act[128] = "";
+	struct split_range ranges[8];
+	size_t len = 0;
+	size_t i, n;
+
+	n = split_find(src, strlen(src), 1, ranges, 8);
+	for (i = 0; i < n; i++) {
+		len += (size_t)snprintf(&act[len], sizeof(act) - len,
+		    "%s%zu-%zu",
+		    i > 0 ? " " : "", ranges[i].sr_beg, ranges[i].sr_end);
+	}
+	if (strcmp(exp, act) != 0) {
+		fprintf(stderr, "split_find:%d:\n\texp %s\n\tgot %s\n",
+		    lno, exp, act);
+		return 1;
+	}
+	return 0;
+}
+
+static int
+test_knfmt_format0(const char *style, unsigned int flags, const char *src,
+    const char *exp, int lno)
+{
+	struct knfmt *kf;
+	const char *act;
+	size_t len = 0;
+	int error = 0;
+	int i;
+
+	kf = knfmt_alloc(style, style != NULL ? strlen(style) : 0, flags);
+	/* Exercise reuse of the context. */
+	for (i = 0; i < 2; i++) {
+		act = knfmt_format(kf, src, strlen(src), &len);
+		if (exp == NULL && act == NULL)
+			continue;
+		if (act == NULL) {
+			act = "NULL";
+			len = strlen(act);
+		}
+		if (exp == NULL)
+			exp = "NULL";
+		if (strlen(exp) != len || strncmp(exp, act, len) != 0) {
+			const char *fun = "knfmt_format";
+
+			fprintf(stderr, "%s:%d:\n\texp %s\n\tgot %.*s\n",
+			    fun, lno, exp, (int)len, act);
+			error = 1;
+			break;
+		}
+	}
+	knfmt_free(kf);
+	return error;
+}
+
+static int
+test_knfmt_changes0(const char *src, size_t off, size_t rmlen,
+    const char *ins, const char *exp, int lno)
+{
+	struct knfmt_changes *kc;
+	struct knfmt *kf;
+	const char *act;
+	size_t len = 0;
+	int error = 0;
+
+	kf = knfmt_alloc(NULL, 0, 0);
+	kc = knfmt_changes_alloc(kf, src, strlen(src));
+	if (knfmt_changes_edit(kc, off, rmlen, ins, strlen(ins))) {
+		act = "OUT OF BOUNDS";
+		len = strlen(act);
+	} else {
+		act = knfmt_changes_format(kc, &len);
+	}
+	if (exp == NULL)
+		exp = "OUT OF BOUNDS";
+	if (act == NULL) {
+		act = "NULL";
+		len = strlen(act);
+	}
+	if (strlen(exp) != len || strncmp(exp, act, len) != 0) {
+		const char *fun = "knfmt_changes";
+
+		fprintf(stderr, "%s:%d:\n\texp %s\n\tgot %.*s\n",
+		    fun, lno, exp, (int)len, act);
+		error = 1;
+	}
+	knfmt_changes_free(kc);
+	knfmt_free(kf);
+	return error;
+}
+
+static int
+test_knfmt_changes_twice0(const char *src, size_t off1, size_t rmlen1,
+    const char *ins1, size_t off2, size_t rmlen2, const char *ins2,
+    const char *exp, int lno)
+{
+	struct knfmt_changes *kc;
+	struct knfmt *kf;
+	const char *act;
+	size_t len = 0;
+	int error = 0;
+
+	kf = knfmt_alloc(NULL, 0, 0);
+	kc = knfmt_changes_alloc(kf, src, strlen(src));
+	if (knfmt_changes_edit(kc, off1, rmlen1, ins1, strlen(ins1)) ||
+	    knfmt_changes_format(kc, &len) == NULL ||
+	    knfmt_changes_edit(kc, off2, rmlen2, ins2, strlen(ins2)))
+		errx(1, "knfmt_changes:%d: edit failed", lno);
+	act = knfmt_changes_format(kc, &len);
+	if (act == NULL) {
+		act = "NULL";
+		len = strlen(act);
+	}
+	if (strlen(exp) != len || strncmp(exp, act, len) != 0) {
+		const char *fun = "knfmt_changes";
+
+		fprintf(stderr, "%s:%d:\n\texp %s\n\tgot %.*s\n",
+		    fun, lno, exp, (int)len, act);
+		error = 1;
+	}
+	knfmt_changes_free(kc);
+	knfmt_free(kf);
+	return error;
+}
+
 static int
 test_tmptemplate0(const char *path, const char *exp, int lno)
 {
@@ -905,3 +1293,48 @@ out:
 	buffer_free(bf);
 	return str;
 }
+
+/*
+ * Dump all tokens including position, flags and branch links, used to compare
+ * lexers.
+ */
+static char *
+tokens_dump(struct lexer *lx)
+{
+	struct buffer *bf;
+	struct token *tk;
+	char *str;
+
+	bf = buffer_alloc(128);
+	if (bf == NULL)
+		err(1, NULL);
+
+	if (!lexer_pop(lx, &tk))
+		errx(1, "tokens_dump: out of tokens");
+	for (; tk != NULL; tk = token_next(tk)) {
+		const struct token *fix;
+
+		TAILQ_FOREACH(fix, &tk->tk_prefixes, tk_entry)
+			token_dump(bf, fix, "  ");
+		token_dump(bf, tk, "");
+		TAILQ_FOREACH(fix, &tk->tk_suffixes, tk_entry)
+			token_dump(bf, fix, "    ");
+	}
+	str = buffer_str(bf);
+	buffer_free(bf);
+	return str;
+}
+
+static void
+token_dump(struct buffer *bf, const struct token *tk, const char *indent)
+{
+	const struct token *pv = tk->tk_branch.br_pv;
+	const struct token *nx = tk->tk_branch.br_nx;
+
+	buffer_printf(bf, "%s%s<%u:%u,%zu,0x%x,%c%zd,%zd>(\"%.*s\")\n",
+	    indent, token_type_str(tk->tk_type), tk->tk_lno, tk->tk_cno,
+	    tk->tk_off, tk->tk_flags, tk->tk_branch.br_parent ? 'P' : '-',
+	    pv != NULL ? (ssize_t)pv->tk_off : -1,
+	    nx != NULL ? (ssize_t)nx->tk_off : -1,
+	    (int)tk->tk_len, tk->tk_str);
+}
@@ -0,0 +1,59 @@
+# Stack exhaustion and scaling regression for long chains of binary operators.
+
+set -e
+
+_wrkdir="$(mktemp -dt knfmt.XXXXXX)"
+trap 'rm -r $_wrkdir' EXIT
+cd "$_wrkdir"
+
+# chain file operands
+chain() {
+	awk -v n="$2" 'BEGIN {
+		printf("int x = x0");
+		for (i = 1; i < n; i++)
+			printf(" | x%d", i);
+		printf(";\n");
+	}' >"$1"
+}
+
+# costs file
+#
+# Write the work required to format the given file, one kind per line.
+costs() {
+	${EXEC:-} "$KNFMT" -tp "$1" 2>"${1}.trace" >/dev/null
+	sed -n -e 's/^\[P\] .*: total: //p' "${1}.trace" | tr ',' '\n' |
+	sed -e 's/^ *//' >"${1}.costs"
+}
+
+chain small.c 1000
+chain large.c 100000
+
+while read -r _style; do
+	printf '%s\n' "$_style" | tr ';' '\n' >.clang-format
+	costs small.c
+	costs large.c
+
+	# The work per token must not grow along with the number of operands.
+	awk -v style="$_style" '
+	FILENAME == ARGV[1] { small[$1] = $2; next }
+	{ large[$1] = $2 }
+	END {
+		for (kind in large) {
+			if (kind == "token" || small[kind] == 0)
+				continue;
+			s = small[kind] / small["token"];
+			l = large[kind] / large["token"];
+			if (l > 2 * s) {
+				printf("%s: %s: %.2f per token, expected %.2f\n",
+				    style, kind, l, s);
+				error = 1;
+			}
+		}
+		exit error;
+	}' small.c.costs large.c.costs 1>&2
+done <<EOF
+
+AlignOperands: Align
+BreakBeforeBinaryOperators: All
+AlignOperands: Align;BreakBeforeBinaryOperators: All
+EOF
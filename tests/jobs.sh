@@ -0,0 +1,30 @@
+# Formatting a large file split across threads must not alter the output.
+
+set -e
+
+_wrkdir="$(mktemp -dt knfmt.XXXXXX)"
+trap 'rm -r $_wrkdir' EXIT
+cd "$_wrkdir"
+
+_i=0
+while [ "$_i" -lt 2000 ]; do
+	cat <<EOF
+#if defined(F${_i})
+static int f${_i}(void);
+#endif
+
+/* Comment with a brace {. */
+int
+f${_i}(int  x)
+{
+	if (x)  return "}"[0];
+	return  x;
+}
+
+EOF
+	_i=$((_i + 1))
+done >a.c
+
+${EXEC:-} "$KNFMT" a.c >exp
+${EXEC:-} "$KNFMT" -j 4 a.c >act
+diff -u exp act
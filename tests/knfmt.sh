@@ -23,11 +23,42 @@ hascomm() {
 	fi
 }
 
+# budget file budget [-- knfmt-options]
+#
+# Ensure the work required to format the given file stays within the budget,
+# declaring the maximum amount of work of each kind per token.
+budget() {
+	local _budget
+	local _file
+
+	_file="$1"; : "${_file:?}"; shift
+	_budget="$1"; : "${_budget:?}"; shift
+	[ "${1:-}" = "--" ] && shift
+
+	(cd "$_wrkdir" && ${EXEC:-} "${KNFMT}" -tp "$@" "$_file" 2>&1 >/dev/null) |
+	sed -n -e 's/^\[P\] .*: total: //p' | tr ',' '\n' >"${_wrkdir}/costs"
+	awk '
+	FILENAME == ARGV[1] { costs[$1] = $2; next }
+	!($1 in costs) || costs["token"] == 0 {
+		printf("%s: %s: unknown work\n", FILENAME, $1)
+		error = 1
+		next
+	}
+	costs[$1] / costs["token"] > $2 {
+		printf("%s: %s: %.2f per token exceeds %s\n", FILENAME, $1,
+		    costs[$1] / costs["token"], $2)
+		error = 1
+	}
+	END { exit error }
+	' "${_wrkdir}/costs" "$_budget" 1>&2
+}
+
 # testcase [-b] [-c] [-e] [-i] [-o] [-q] file [-- knfmt-options]
 #
 # Run test case.
 testcase() {
 	local _base
+	local _budget
 	local _bug=0
 	local _clang=0
 	local _diff="${_wrkdir}/diff"
@@ -58,6 +89,7 @@ testcase() {
 	_base="${_name%.c}"
 	_ok="${_file%.c}.ok"
 	_patch="${_file%.c}.patch"
+	_budget="${_file%.c}.budget"
 
 	if [ "$_clang" -eq 1 ]; then
 		sed -n -e '/^[\/ ]\* /s/^[\/ ]\* //p' -e '/^$/q' "$_file" |
@@ -92,6 +124,11 @@ testcase() {
 			return 1
 		fi
 	else
+		if [ "$_clang" -eq 1 ]; then
+			# Style is honored relative to the file.
+			cp "$_file" "${_wrkdir}/${_name}"
+			_file="${_wrkdir}/${_name}"
+		fi
 		(cd "$_wrkdir" && ${EXEC:-} "${KNFMT}" ${_flags:+-${_flags}} "$@" "$_file") \
 			>"$_out" 2>&1 || _got="$?"
 	fi
@@ -117,6 +154,11 @@ testcase() {
 		cat "$_out" 1>&2
 		return 1
 	fi
+
+	if [ -e "$_budget" ]; then
+		[ -e "$_patch" ] || _patch=/dev/null
+		budget "$_file" "$_budget" -- "$@" <"$_patch" || return 1
+	fi
 }
 
 # Enable hardening malloc(3) options on OpenBSD.
@@ -168,6 +210,9 @@ inplace-*)
 	cp "$_abs" "${_wrkdir}/test.c"
 	testcase -i "${_wrkdir}/test.c" -- -i "$@"
 	;;
+recover-*)
+	testcase -e "$_abs" -- -r "$@"
+	;;
 simple-*|../*)
 	testcase "$_abs" -- -s "$@"
 	;;
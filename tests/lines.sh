@@ -0,0 +1,45 @@
+# Only format the given range of lines.
+
+set -e
+
+_wrkdir="$(mktemp -dt knfmt.XXXXXX)"
+trap 'rm -r $_wrkdir' EXIT
+cd "$_wrkdir"
+
+cat <<'EOF' >a.c
+int	x;
+int y;
+
+static int  z;
+
+int
+main(void)
+{
+	if (x)
+		return  1;
+	return  0;
+}
+EOF
+
+cat <<'EOF' >exp
+int	x;
+int	y;
+
+static int  z;
+
+int
+main(void)
+{
+	if (x)
+		return  1;
+	return 0;
+}
+EOF
+
+${EXEC:-} "$KNFMT" -L 2:2 -L 11:11 a.c >act
+diff -u exp act
+
+${EXEC:-} "$KNFMT" -L 2:1 a.c 2>/dev/null && exit 1
+# Changed lines cannot be given both as ranges and as a diff.
+${EXEC:-} "$KNFMT" -D -L 2:2 a.c </dev/null 2>/dev/null && exit 1
+exit 0
@@ -0,0 +1,52 @@
+# Exceeding the memory limit must only fail the offending file.
+
+set -e
+
+_wrkdir="$(mktemp -dt knfmt.XXXXXX)"
+trap 'rm -r $_wrkdir' EXIT
+cd "$_wrkdir"
+
+_i=0
+while [ "$_i" -lt 2000 ]; do
+	cat <<EOF
+int
+f${_i}(int  x)
+{
+	return  x;
+}
+
+EOF
+	_i=$((_i + 1))
+done >a.c
+printf 'int\tx;\n' >b.c
+
+if ${EXEC:-} "$KNFMT" -m 1 a.c b.c >out 2>err; then
+	echo "expected exit status 1" 1>&2
+	exit 1
+fi
+grep -q 'a.c:[0-9]*: memory limit exceeded' err
+diff -u b.c out
+
+# Storage kept for reuse after exceeding the limit must not fail the next file.
+awk 'BEGIN {
+	for (i = 0; i < 20000; i++)
+		printf("int\nf%d(int  x)\n{\n\treturn  x;\n}\n\n", i)
+}' >c.c
+if ${EXEC:-} "$KNFMT" -m 1 c.c b.c >out 2>err; then
+	echo "expected exit status 1" 1>&2
+	exit 1
+fi
+if grep -q 'b.c:[0-9]*: memory limit exceeded' err; then
+	cat err 1>&2
+	exit 1
+fi
+diff -u b.c out
+
+${EXEC:-} "$KNFMT" -m 64 a.c >/dev/null
+
+for _arg in 0 -1 x; do
+	if ${EXEC:-} "$KNFMT" -m "$_arg" b.c >/dev/null 2>&1; then
+		echo "expected invalid limit ${_arg} to be rejected" 1>&2
+		exit 1
+	fi
+done
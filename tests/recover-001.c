@@ -0,0 +1,30 @@
+/*
+ * Recover from declarations which cannot be parsed.
+ */
+
+/* Leading comment. */
+int
+a(void)
+{
+	return   1;
+}
+
+/* Broken. */
+int
+b(void)
+{
+	do
+	while (1);
+}
+
+int	c   = 1;
+STATIC const struct m   m = {
+	.=	open,
+};
+int   e;
+
+int
+f(void)
+{
+	return 2;
+}
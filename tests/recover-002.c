@@ -0,0 +1,14 @@
+/*
+ * Errors must only be reported once for the failing declaration, redundant
+ * semicolons are part of it.
+ */
+
+int
+main(void)
+{
+	return 0;
+}
+
+FOO(bar) BAZ { x y z ; } ;;
+
+static int d  = 1;
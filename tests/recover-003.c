@@ -0,0 +1,8 @@
+/*
+ * Declarations failing without an error must be reported at their first
+ * token.
+ */
+
+int	a;
+= 1;
+int	b;
@@ -0,0 +1,30 @@
+# Parser state leaking into the next file regression.
+
+set -e
+
+_wrkdir="$(mktemp -dt knfmt.XXXXXX)"
+trap 'rm -r $_wrkdir' EXIT
+cd "$_wrkdir"
+
+cat <<'EOF' >a.c
+int
+main(void)
+{
+	HASH_ITER(hh, item, aux)
+	foo bar;
+}
+EOF
+
+cat <<'EOF' >b.c
+int
+main(void)
+{
+	return x + y;
+}
+EOF
+
+for _f in a.c b.c a.c; do
+	${EXEC:-} "$KNFMT" "$_f"
+done >exp
+${EXEC:-} "$KNFMT" a.c b.c a.c >act
+diff -u exp act
@@ -0,0 +1,33 @@
+# Style resolved relative to each file.
+
+set -e
+
+_wrkdir="$(mktemp -dt knfmt.XXXXXX)"
+trap 'rm -r $_wrkdir' EXIT
+cd "$_wrkdir"
+
+mkdir -p a/b c
+cat <<'EOF' >a/.clang-format
+UseTab: Never
+IndentWidth: 4
+EOF
+
+cat <<'EOF' >a/a.c
+int
+main(void)
+{
+    return 0;
+}
+EOF
+cp a/a.c a/b/b.c
+
+cat <<'EOF' >c/c.c
+int
+main(void)
+{
+	return 0;
+}
+EOF
+
+${EXEC:-} "$KNFMT" -d a/a.c c/c.c a/b/b.c
+(cd a/b && ${EXEC:-} "$KNFMT" -d ../../c/c.c b.c)
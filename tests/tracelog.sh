@@ -0,0 +1,43 @@
+# The binary event log must decode into the same events as the traces.
+
+set -e
+
+_wrkdir="$(mktemp -dt knfmt.XXXXXX)"
+trap 'rm -r $_wrkdir' EXIT
+cd "$_wrkdir"
+
+cat <<EOF >a.c
+#if A
+int a;
+#else
+int b;
+#endif
+int
+main(void)
+{
+	if (x)
+		return 0;
+}
+EOF
+
+# Must not be implied by all traces.
+${EXEC:-} "$KNFMT" -ta a.c 2>&1 >/dev/null | grep -q knfmtlog && exit 1
+
+# Tokens are only represented by their type and position in the event log.
+${EXEC:-} "$KNFMT" -tl a.c 2>&1 >/dev/null |
+sed -E -e 's/(<[0-9]+:[0-9]+)[^>]*>\("([^"\\]|\\.)*"\)/\1>/g' >exp
+KNFMT_TRACELOG=log ${EXEC:-} "$KNFMT" -tbl a.c >/dev/null
+${EXEC:-} "$TRACELOG_DECODE" log >act
+diff -u exp act
+
+# Documents are only represented by their value.
+${EXEC:-} "$KNFMT" -td a.c 2>&1 >/dev/null | wc -l >exp
+${EXEC:-} "$KNFMT" -tbd a.c 2>&1 >/dev/null |
+${EXEC:-} "$TRACELOG_DECODE" | wc -l >act
+diff -u exp act
+
+# Anything written to stderr before the event log is ignored.
+printf 'int x\n' >b.c
+{ ${EXEC:-} "$KNFMT" -tbl b.c a.c 2>&1 >/dev/null || :; } |
+${EXEC:-} "$TRACELOG_DECODE" >act
+[ -s act ]
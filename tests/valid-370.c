@@ -0,0 +1,33 @@
+/*
+ * Branches taken in nested statement blocks.
+ */
+
+int
+main(void)
+{
+	int error = 0;
+
+	if (error) {
+		x = 1;
+#if defined(A)
+		y = 1;
+		z = 1;
+#elif defined(B)
+		y = 2;
+#else
+		y = 3;
+		z = 3;
+#endif
+		while (y > 0) {
+#ifdef C
+			y--;
+#else
+			y -= 2;
+#endif
+		}
+	}
+#ifdef D
+	return 1;
+#endif
+	return 0;
+}
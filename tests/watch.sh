@@ -0,0 +1,48 @@
+# Watch mode must only format changed source files and keep running.
+
+set -e
+
+# Watch mode is not supported on all platforms.
+if ${EXEC:-} "$KNFMT" -w enoent 2>&1 | grep -q 'not supported'; then
+	exit 0
+fi
+
+_wrkdir="$(mktemp -dt knfmt.XXXXXX)"
+_pid=""
+trap '[ -z "$_pid" ] || kill "$_pid" 2>/dev/null || :; rm -r $_wrkdir' EXIT
+cd "$_wrkdir"
+
+# Keep changing the given file until formatted, as the watch might not yet be
+# in place.
+change() {
+	_i=0
+	while [ "$_i" -lt 50 ]; do
+		printf 'int\nmain(void)\n{\n\treturn  0;\n}\n' >"$1"
+		sleep 0.2
+		if cmp -s exp "$1"; then
+			return 0
+		fi
+		_i=$((_i + 1))
+	done
+	echo "${1}: not formatted" 1>&2
+	return 1
+}
+
+printf 'int\nmain(void)\n{\n\treturn 0;\n}\n' >exp
+mkdir d
+printf 'int  x;\n' >a.c
+printf 'int  x;\n' >b.c
+printf 'int  x;\n' >d/c.txt
+
+${EXEC:-} "$KNFMT" -iw a.c d &
+_pid=$!
+
+change a.c
+change d/c.c
+# Untouched and non-source files must be left as is.
+printf 'int  x;\n' | cmp -s - b.c
+printf 'int  x;\n' >d/c.txt
+sleep 0.5
+printf 'int  x;\n' | cmp -s - d/c.txt
+# Must still be running.
+kill -0 "$_pid"
@@ -11,6 +11,7 @@
 
 #include "alloc.h"
 #include "lexer.h"
+#include "profile.h"
 #include "util.h"
 
 static char	*token_serialize_impl(const struct token *, int);
@@ -19,7 +20,6 @@ static struct token	*token_list_find(const struct token_list *, int,
     unsigned int);
 
 static void		 strflags(struct buffer *, unsigned int);
-static const char	*token_type_str(int);
 
 #ifdef HAVE_QUEUE
 #  include <sys/queue.h>
@@ -34,6 +34,9 @@ token_alloc(const struct token *def)
 
 	tk = ecalloc(1, sizeof(*tk));
 	token_init(tk, def);
+	profile_alloc(PROFILE_TOKEN, token_type_str(tk->tk_type), NULL, 0,
+	    sizeof(*tk));
+	profile_cost(PROFILE_COST_TOKEN, tk->tk_lno, 1);
 	return tk;
 }
 
@@ -68,8 +71,11 @@ token_rele(struct token *tk)
 	}
 	while ((fix = TAILQ_FIRST(&tk->tk_suffixes)) != NULL)
 		token_list_remove(&tk->tk_suffixes, fix);
-	if (tk->tk_flags & TOKEN_FLAG_DIRTY)
+	if (tk->tk_flags & TOKEN_FLAG_DIRTY) {
 		free((void *)tk->tk_str);
+		profile_free(PROFILE_TOKEN, tk->tk_len + 1);
+	}
+	profile_free(PROFILE_TOKEN, sizeof(*tk));
 	free(tk);
 }
 
@@ -379,6 +385,25 @@ token_is_first(const struct token *tk)
 	return pv == NULL || pv->tk_lno != tk->tk_lno;
 }
 
+/*
+ * Returns non-zero if the given token is emitted without any accompanying
+ * documents, i.e. no prefixes and only discarded suffixes.
+ */
+int
+token_is_bare(const struct token *tk)
+{
+	const struct token *suffix;
+
+	if ((tk->tk_flags & TOKEN_FLAG_UNMUTE) ||
+	    !TAILQ_EMPTY(&tk->tk_prefixes))
+		return 0;
+	TAILQ_FOREACH(suffix, &tk->tk_suffixes, tk_entry) {
+		if ((suffix->tk_flags & TOKEN_FLAG_DISCARD) == 0)
+			return 0;
+	}
+	return 1;
+}
+
 /*
  * Returns the branch continuation associated with the given token if present.
  */
@@ -667,7 +692,7 @@ strflags(struct buffer *bf, unsigned int token_flags)
 	}
 }
 
-static const char *
+const char *
 token_type_str(int token_type)
 {
 	switch (token_type) {
@@ -173,6 +173,8 @@ struct token {
 #define TOKEN_FLAG_SPACE	0x00008000u
 /* Token covered by diff chunk. */
 #define TOKEN_FLAG_DIFF		0x00010000u
+/* Lexing can resume after token, see lexer_edit(). */
+#define TOKEN_FLAG_RESUME	0x00020000u
 /* was TOKEN_FLAG_TYPE_ARGS	0x08000000u */
 #define TOKEN_FLAG_TYPE_FUNC	0x10000000u
 
@@ -199,6 +201,7 @@ void		 token_rele(struct token *);
 int		 token_trim(struct token *);
 char		*token_serialize(const struct token *);
 char		*token_serialize_no_flags(const struct token *);
+const char	*token_type_str(int);
 
 void	token_position_after(struct token *, struct token *);
 
@@ -216,6 +219,7 @@ int	token_is_branch(const struct token *);
 int	token_is_decl(const struct token *, int);
 int	token_is_moveable(const struct token *);
 int	token_is_first(const struct token *);
+int	token_is_bare(const struct token *);
 
 struct token	*token_get_branch(struct token *);
 
@@ -0,0 +1,34 @@
+#include "config.h"
+
+#include <err.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "tracelog.h"
+
+/*
+ * Decode the given event log, as written by knfmt when tracing with the b
+ * flag, or stdin by default.
+ */
+int
+main(int argc, char *argv[])
+{
+	const char *path = "stdin";
+	FILE *fp = stdin;
+	int error;
+
+	if (argc > 2) {
+		fprintf(stderr, "usage: tracelog-decode [file]\n");
+		return 1;
+	}
+	if (argc == 2 && strcmp(argv[1], "-") != 0) {
+		path = argv[1];
+		fp = fopen(path, "r");
+		if (fp == NULL)
+			err(1, "%s", path);
+	}
+	error = tracelog_decode(fp, path, stdout);
+	if (fp != stdin)
+		fclose(fp);
+	return error;
+}
@@ -0,0 +1,527 @@
+#include "tracelog.h"
+
+#include "config.h"
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libks/buffer.h"
+#include "libks/compiler.h"
+
+#include "alloc.h"
+#include "token.h"
+#include "util.h"
+
+/* Number of records in the ring, must be a power of two. */
+#define TRACELOG_NRECORDS	(1u << 15)
+
+#define TRACELOG_NINTS		8
+#define TRACELOG_NTOKENS	4
+#define TRACELOG_TEXTSIZ	64
+
+#define TRACELOG_MAGIC		"knfmtlog"
+#define TRACELOG_VERSION	1
+
+/*
+ * Token as recorded in the event log, only referring to its position in the
+ * source as serializing it is costly.
+ */
+struct tracelog_token {
+	int32_t		type;	/* -1 if absent */
+	uint32_t	lno;	/* 0 if not positioned */
+	uint32_t	cno;
+};
+
+struct tracelog_record {
+	uint32_t		tr_event;
+	int32_t			tr_ints[TRACELOG_NINTS];
+	struct tracelog_token	tr_tokens[TRACELOG_NTOKENS];
+	/* Consecutive NUL-terminated strings, possibly truncated. */
+	char			tr_text[TRACELOG_TEXTSIZ];
+};
+
+struct tracelog_header {
+	char		th_magic[8];
+	uint32_t	th_version;
+	uint32_t	th_size;	/* size of each record */
+	uint64_t	th_nevents;	/* number of recorded events */
+};
+
+/*
+ * Each event is described by a format string understood by tracelog_vformat()
+ * and the decoder, using the following conversions:
+ *
+ *     %T    token
+ *     %c    character
+ *     %d    integer
+ *     %s    string
+ *     %q    quoted string, with non-printable characters escaped
+ *     %i    indentation, 2 spaces for each level
+ *     %r    ruler, 1 dash plus 2 dashes for each level
+ */
+static const struct tracelog_description {
+	unsigned char	 ident;
+	const char	*fun;
+	const char	*fmt;
+} tracelog_descriptions[] = {
+	[TRACELOG_LEXER_STAMP] = {
+		'L', "lexer_stamp", "stamp %T",
+	},
+	[TRACELOG_LEXER_RECOVER_BACK] = {
+		'L', "lexer_recover", "back %T",
+	},
+	[TRACELOG_LEXER_RECOVER_BRANCH] = {
+		'L', "lexer_recover", "branch from %T to %T covering [%T, %T)",
+	},
+	[TRACELOG_LEXER_RECOVER_SEEK] = {
+		'L', "lexer_recover", "seek to %T, removing %d document(s)",
+	},
+	[TRACELOG_LEXER_RECOVER_PREFIX] = {
+		'L', "lexer_recover_verbatim", "add prefix %T to %T",
+	},
+	[TRACELOG_LEXER_RECOVER_REMOVE] = {
+		'L', "lexer_recover_verbatim", "removing %T",
+	},
+	[TRACELOG_LEXER_SEEK_UNCHANGED] = {
+		'L', "lexer_seek_unchanged", "seek to %T",
+	},
+	[TRACELOG_LEXER_SEEK] = {
+		'L', "lexer_seek", "seek to %T",
+	},
+	[TRACELOG_LEXER_HALT] = {
+		'L', "lexer_pop", "halt %T",
+	},
+	[TRACELOG_LEXER_SUPPRESSED] = {
+		'L', "lexer_expect_error", "%s:%d: suppressed, expected %T",
+	},
+	[TRACELOG_LEXER_BRANCH_TAKE] = {
+		'L', "lexer_branch_take",
+		"branch from %T to %T, covering [%T, %T)",
+	},
+	[TRACELOG_LEXER_BRANCH_TAKE_REMOVE] = {
+		'L', "lexer_branch_take", "removing %T",
+	},
+	[TRACELOG_LEXER_BRANCH_REWIND] = {
+		'L', "lexer_branch_rewind", "seek to %T",
+	},
+	[TRACELOG_LEXER_BRANCH_FOLD_UNLINK] = {
+		'L', "lexer_branch_fold", "removing prefix %T",
+	},
+	[TRACELOG_LEXER_BRANCH_FOLD_PREFIX] = {
+		'L', "lexer_branch_fold", "add prefix %T to %T",
+	},
+	[TRACELOG_LEXER_BRANCH_FOLD_KEEP] = {
+		'L', "lexer_branch_fold", "keeping prefix %T",
+	},
+	[TRACELOG_LEXER_BRANCH_FOLD_REMOVE] = {
+		'L', "lexer_branch_fold", "removing %T",
+	},
+	[TRACELOG_DOC_ENTER] = {
+		'D', NULL, "[%c C=%d D=%d U=%d O=%d] %i%s<%s:%d>(%s",
+	},
+	[TRACELOG_DOC_ENTER_INT] = {
+		'D', NULL, "[%c C=%d D=%d U=%d O=%d] %i%s<%s:%d>(%d",
+	},
+	[TRACELOG_DOC_ENTER_STRING] = {
+		'D', NULL, "[%c C=%d D=%d U=%d O=%d] %i%s<%s:%d>(%q",
+	},
+	[TRACELOG_DOC_LEAVE] = {
+		'D', NULL, "[%c C=%d D=%d U=%d O=%d] %i%s)",
+	},
+	[TRACELOG_DOC_MESSAGE] = {
+		'D', NULL, "[%c C=%d D=%d U=%d O=%d]%r%s",
+	},
+};
+
+static struct {
+	struct tracelog_record	*records;
+	uint64_t		 nevents;
+} tracelog_ring;
+
+static const struct tracelog_description	*tracelog_description(
+    enum tracelog_event);
+
+static void	tracelog_text(struct tracelog_record *, size_t *,
+    const char *);
+static void	tracelog_quote(struct buffer *, const char *);
+static void	tracelog_repeat(struct buffer *, char, int);
+static int	tracelog_seek(FILE *);
+
+/*
+ * Record the given event in the ring buffer, eventually written by
+ * tracelog_shutdown(). The variadic arguments must adhere to
+ * the format string of the event. Once the ring is full, the oldest events are
+ * overwritten.
+ */
+void
+tracelog(enum tracelog_event ev, ...)
+{
+	va_list ap;
+
+	va_start(ap, ev);
+	tracelog_vrecord(ev, ap);
+	va_end(ap);
+}
+
+void
+tracelog_vrecord(enum tracelog_event ev, va_list ap)
+{
+	const struct tracelog_description *desc = tracelog_description(ev);
+	struct tracelog_record *tr;
+	const char *fmt;
+	size_t nints = 0;
+	size_t ntokens = 0;
+	size_t ntext = 0;
+
+	if (tracelog_ring.records == NULL) {
+		tracelog_ring.records = ecalloc(TRACELOG_NRECORDS,
+		    sizeof(*tracelog_ring.records));
+	}
+	tr = &tracelog_ring.records[
+	    tracelog_ring.nevents++ & (TRACELOG_NRECORDS - 1)];
+	memset(tr, 0, sizeof(*tr));
+	tr->tr_event = ev;
+
+	for (fmt = desc->fmt; *fmt != '\0'; fmt++) {
+		if (*fmt != '%')
+			continue;
+
+		switch (*++fmt) {
+		case 'T': {
+			const struct token *tk;
+			struct tracelog_token *dst;
+
+			tk = va_arg(ap, const struct token *);
+			if (ntokens == TRACELOG_NTOKENS)
+				break;
+			dst = &tr->tr_tokens[ntokens++];
+			dst->type = tk != NULL ? tk->tk_type : -1;
+			if (tk != NULL && tk->tk_str != NULL) {
+				dst->lno = tk->tk_lno;
+				dst->cno = tk->tk_cno;
+			}
+			break;
+		}
+
+		case 'c':
+		case 'd':
+		case 'i':
+		case 'r': {
+			int val;
+
+			val = va_arg(ap, int);
+			if (nints < TRACELOG_NINTS)
+				tr->tr_ints[nints++] = val;
+			break;
+		}
+
+		case 'q':
+		case 's':
+			tracelog_text(tr, &ntext, va_arg(ap, const char *));
+			break;
+
+		default:
+			break;
+		}
+	}
+}
+
+/*
+ * Write the recorded events, if any, in chronological order to the path given
+ * by TRACELOG_ENV or stderr.
+ */
+void
+tracelog_shutdown(void)
+{
+	struct tracelog_header th;
+	const char *path;
+	FILE *fp;
+	uint64_t beg = 0;
+	uint64_t i;
+
+	if (tracelog_ring.records == NULL)
+		return;
+
+	path = getenv(TRACELOG_ENV);
+	if (path != NULL && path[0] != '\0') {
+		fp = fopen(path, "w");
+		if (fp == NULL) {
+			warn("%s", path);
+			goto out;
+		}
+	} else {
+		path = "stderr";
+		fp = stderr;
+	}
+
+	memset(&th, 0, sizeof(th));
+	memcpy(th.th_magic, TRACELOG_MAGIC, sizeof(th.th_magic));
+	th.th_version = TRACELOG_VERSION;
+	th.th_size = sizeof(struct tracelog_record);
+	th.th_nevents = tracelog_ring.nevents;
+	if (tracelog_ring.nevents > TRACELOG_NRECORDS)
+		beg = tracelog_ring.nevents - TRACELOG_NRECORDS;
+	fwrite(&th, sizeof(th), 1, fp);
+	for (i = beg; i < tracelog_ring.nevents; i++) {
+		fwrite(&tracelog_ring.records[i & (TRACELOG_NRECORDS - 1)],
+		    sizeof(*tracelog_ring.records), 1, fp);
+	}
+	if (ferror(fp))
+		warnx("%s: write error", path);
+	if (fp == stderr)
+		fflush(fp);
+	else
+		fclose(fp);
+
+out:
+	free(tracelog_ring.records);
+	tracelog_ring.records = NULL;
+	tracelog_ring.nevents = 0;
+}
+
+/*
+ * Format the given event without recording it. Tokens are serialized using
+ * the given callback.
+ */
+void
+tracelog_vformat(struct buffer *bf, enum tracelog_event ev, va_list ap,
+    const char *(*serialize)(void *, const struct token *), void *arg)
+{
+	const char *fmt;
+
+	for (fmt = tracelog_description(ev)->fmt; *fmt != '\0'; fmt++) {
+		if (*fmt != '%') {
+			buffer_putc(bf, *fmt);
+			continue;
+		}
+
+		switch (*++fmt) {
+		case 'T':
+			buffer_printf(bf, "%s",
+			    serialize(arg, va_arg(ap, const struct token *)));
+			break;
+		case 'c':
+			buffer_putc(bf, (char)va_arg(ap, int));
+			break;
+		case 'd':
+			buffer_printf(bf, "%d", va_arg(ap, int));
+			break;
+		case 'i':
+			tracelog_repeat(bf, ' ', 2 * va_arg(ap, int));
+			break;
+		case 'r':
+			tracelog_repeat(bf, '-', 2 * va_arg(ap, int) + 1);
+			break;
+		case 'q':
+			tracelog_quote(bf, va_arg(ap, const char *));
+			break;
+		case 's':
+			buffer_printf(bf, "%s", va_arg(ap, const char *));
+			break;
+		default:
+			buffer_putc(bf, *fmt);
+			break;
+		}
+	}
+}
+
+unsigned char
+tracelog_ident(enum tracelog_event ev)
+{
+	return tracelog_description(ev)->ident;
+}
+
+const char *
+tracelog_fun(enum tracelog_event ev)
+{
+	return tracelog_description(ev)->fun;
+}
+
+/*
+ * Decode the event log written by tracelog_shutdown() read from the given
+ * stream, emitting one line per event in the same form as the corresponding
+ * trace. Tokens are only represented by their type and position. Anything
+ * preceding the event log is ignored, allowing it to be interleaved with other
+ * output written to stderr. Returns non-zero on error.
+ */
+int
+tracelog_decode(FILE *fp, const char *path, FILE *out)
+{
+	struct tracelog_header th;
+	struct tracelog_record tr;
+	struct buffer *bf;
+	uint64_t nrecords = 0;
+	int error = 0;
+
+	if (tracelog_seek(fp) ||
+	    fread((char *)&th + sizeof(th.th_magic),
+	    sizeof(th) - sizeof(th.th_magic), 1, fp) != 1 ||
+	    th.th_version != TRACELOG_VERSION ||
+	    th.th_size != sizeof(tr)) {
+		warnx("%s: not an event log", path);
+		return 1;
+	}
+
+	bf = buffer_alloc(256);
+	if (bf == NULL)
+		err(1, NULL);
+	while (fread(&tr, sizeof(tr), 1, fp) == 1) {
+		const struct tracelog_description *desc;
+		const char *fmt;
+		size_t nints = 0;
+		size_t off = 0;
+		size_t ntokens = 0;
+
+		if (tr.tr_event >= sizeof(tracelog_descriptions) /
+		    sizeof(tracelog_descriptions[0])) {
+			warnx("%s: unknown event %u", path, tr.tr_event);
+			error = 1;
+			break;
+		}
+		nrecords++;
+		desc = &tracelog_descriptions[tr.tr_event];
+		tr.tr_text[sizeof(tr.tr_text) - 1] = '\0';
+
+		buffer_reset(bf);
+		buffer_printf(bf, "[%c] ", desc->ident);
+		if (desc->fun != NULL)
+			buffer_printf(bf, "%s: ", desc->fun);
+		for (fmt = desc->fmt; *fmt != '\0'; fmt++) {
+			const struct tracelog_token *tk;
+			const char *type;
+			int val = 0;
+
+			if (*fmt != '%') {
+				buffer_putc(bf, *fmt);
+				continue;
+			}
+
+			fmt++;
+			if (*fmt == 'T') {
+				tk = &tr.tr_tokens[ntokens++];
+				if (tk->type == -1) {
+					buffer_printf(bf, "(null)");
+					continue;
+				}
+				type = token_type_str(tk->type);
+				buffer_printf(bf, "%s",
+				    type != NULL ? type : "?");
+				if (tk->lno > 0) {
+					buffer_printf(bf, "<%u:%u>",
+					    tk->lno, tk->cno);
+				}
+				continue;
+			}
+			if (*fmt == 'q' || *fmt == 's') {
+				const char *str = "";
+
+				if (off < sizeof(tr.tr_text)) {
+					str = &tr.tr_text[off];
+					off += strlen(str) + 1;
+				}
+				if (*fmt == 'q')
+					tracelog_quote(bf, str);
+				else
+					buffer_printf(bf, "%s", str);
+				continue;
+			}
+			if (*fmt == 'c' || *fmt == 'd' || *fmt == 'i' ||
+			    *fmt == 'r')
+				val = tr.tr_ints[nints++];
+			switch (*fmt) {
+			case 'c':
+				buffer_putc(bf, (char)val);
+				break;
+			case 'd':
+				buffer_printf(bf, "%d", val);
+				break;
+			case 'i':
+				tracelog_repeat(bf, ' ', 2 * val);
+				break;
+			case 'r':
+				tracelog_repeat(bf, '-', 2 * val + 1);
+				break;
+			default:
+				buffer_putc(bf, *fmt);
+				break;
+			}
+		}
+		buffer_putc(bf, '\n');
+		fwrite(buffer_get_ptr(bf), buffer_get_len(bf), 1, out);
+	}
+	if (ferror(fp)) {
+		warn("%s", path);
+		error = 1;
+	}
+	if (error == 0 && th.th_nevents > nrecords) {
+		fprintf(out, "[T] %s: %llu event(s) overwritten\n", path,
+		    (unsigned long long)(th.th_nevents - nrecords));
+	}
+	buffer_free(bf);
+	return error;
+}
+
+static const struct tracelog_description *
+tracelog_description(enum tracelog_event ev)
+{
+	return &tracelog_descriptions[ev];
+}
+
+/*
+ * Append the given string to the text of the record, truncating it if the
+ * text is already full.
+ */
+static void
+tracelog_text(struct tracelog_record *tr, size_t *off, const char *str)
+{
+	size_t len, siz;
+
+	if (*off == sizeof(tr->tr_text))
+		return;
+	siz = sizeof(tr->tr_text) - *off;
+	len = strlen(str);
+	if (len >= siz)
+		len = siz - 1;
+	memcpy(&tr->tr_text[*off], str, len);
+	tr->tr_text[*off + len] = '\0';
+	*off += len + 1;
+}
+
+static void
+tracelog_repeat(struct buffer *bf, char c, int n)
+{
+	for (; n > 0; n--)
+		buffer_putc(bf, c);
+}
+
+static void
+tracelog_quote(struct buffer *bf, const char *str)
+{
+	buffer_putc(bf, '"');
+	strnice_buffer(bf, str, strlen(str));
+	buffer_putc(bf, '"');
+}
+
+/*
+ * Advance the given stream past the magic of the event log. Returns non-zero
+ * if not found.
+ */
+static int
+tracelog_seek(FILE *fp)
+{
+	const char *magic = TRACELOG_MAGIC;
+	size_t len = strlen(magic);
+	size_t n = 0;
+	int ch;
+
+	while (n < len && (ch = fgetc(fp)) != EOF) {
+		if (ch == magic[n])
+			n++;
+		else
+			n = ch == magic[0] ? 1 : 0;
+	}
+	return n < len;
+}
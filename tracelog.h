@@ -0,0 +1,48 @@
+#include <stdarg.h>	/* va_list */
+#include <stdio.h>	/* FILE */
+
+struct buffer;
+struct token;
+
+/*
+ * Environment variable holding the path of the event log written by
+ * tracelog_shutdown(), stderr is used if absent.
+ */
+#define TRACELOG_ENV	"KNFMT_TRACELOG"
+
+enum tracelog_event {
+	TRACELOG_LEXER_STAMP,
+	TRACELOG_LEXER_RECOVER_BACK,
+	TRACELOG_LEXER_RECOVER_BRANCH,
+	TRACELOG_LEXER_RECOVER_SEEK,
+	TRACELOG_LEXER_RECOVER_PREFIX,
+	TRACELOG_LEXER_RECOVER_REMOVE,
+	TRACELOG_LEXER_SEEK_UNCHANGED,
+	TRACELOG_LEXER_SEEK,
+	TRACELOG_LEXER_HALT,
+	TRACELOG_LEXER_SUPPRESSED,
+	TRACELOG_LEXER_BRANCH_TAKE,
+	TRACELOG_LEXER_BRANCH_TAKE_REMOVE,
+	TRACELOG_LEXER_BRANCH_REWIND,
+	TRACELOG_LEXER_BRANCH_FOLD_UNLINK,
+	TRACELOG_LEXER_BRANCH_FOLD_PREFIX,
+	TRACELOG_LEXER_BRANCH_FOLD_KEEP,
+	TRACELOG_LEXER_BRANCH_FOLD_REMOVE,
+	TRACELOG_DOC_ENTER,
+	TRACELOG_DOC_ENTER_INT,
+	TRACELOG_DOC_ENTER_STRING,
+	TRACELOG_DOC_LEAVE,
+	TRACELOG_DOC_MESSAGE,
+};
+
+void	tracelog(enum tracelog_event, ...);
+void	tracelog_vrecord(enum tracelog_event, va_list);
+void	tracelog_shutdown(void);
+
+void	tracelog_vformat(struct buffer *, enum tracelog_event, va_list,
+    const char *(*)(void *, const struct token *), void *);
+
+unsigned char	 tracelog_ident(enum tracelog_event);
+const char	*tracelog_fun(enum tracelog_event);
+
+int	tracelog_decode(FILE *, const char *, FILE *);
@@ -5,27 +5,62 @@
 #include <ctype.h>
 #include <err.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "libks/buffer.h"
 
+#define WORD_ONES		0x0101010101010101ULL
+#define WORD_HIGHS		0x8080808080808080ULL
+/* Non-zero if any byte in the given word equals the given byte. */
+#define WORD_HAS(w, c)							\
+	((((w) ^ (WORD_ONES * (c))) - WORD_ONES) &			\
+	 ~((w) ^ (WORD_ONES * (c))) & WORD_HIGHS)
+
+static int	word_has_special(const char *);
+
+/*
+ * Emit a trace line. The line is formatted into a buffer reused across
+ * invocations and written in one go as stderr is unbuffered.
+ */
 void
 tracef(unsigned char ident, const char *fun, const char *fmt, ...)
 {
+	static struct buffer *bf;
 	va_list ap;
+	int error;
+
+	if (bf == NULL) {
+		bf = buffer_alloc(256);
+		if (bf == NULL)
+			err(1, NULL);
+	}
+	buffer_reset(bf);
 
-	fprintf(stderr, "[%c] %s: ", ident, fun);
+	buffer_printf(bf, "[%c] %s: ", ident, fun);
 	va_start(ap, fmt);
-	vfprintf(stderr, fmt, ap);
+	error = buffer_vprintf(bf, fmt, ap);
 	va_end(ap);
-	fprintf(stderr, "\n");
+	if (error || buffer_putc(bf, '\n'))
+		err(1, NULL);
+	fwrite(buffer_get_ptr(bf), buffer_get_len(bf), 1, stderr);
 }
 
 unsigned int
 colwidth(const char *str, size_t len, unsigned int cno, unsigned int *lno)
 {
-	for (; len > 0; len--, str++) {
-		switch (str[0]) {
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		/* Skip words lacking tabs and newlines. */
+		if (len - i >= sizeof(uint64_t) && !word_has_special(&str[i])) {
+			cno += sizeof(uint64_t);
+			i += sizeof(uint64_t) - 1;
+			continue;
+		}
+
+		switch (str[i]) {
 		case '\n':
 			cno = 1;
 			if (lno != NULL)
@@ -108,12 +143,30 @@ strwidth(const char *str, size_t len, size_t pos)
 	size_t i;
 
 	for (i = 0; i < len; i++) {
-		if (str[i] == '\n')
+		/* Skip words lacking tabs and newlines. */
+		if (len - i >= sizeof(uint64_t) && !word_has_special(&str[i])) {
+			pos += sizeof(uint64_t);
+			i += sizeof(uint64_t) - 1;
+		} else if (str[i] == '\n') {
 			pos = 0;
-		else if (str[i] == '\t')
+		} else if (str[i] == '\t') {
 			pos += 8 - (pos % 8);
-		else
+		} else {
 			pos += 1;
+		}
 	}
 	return pos;
 }
+
+/*
+ * Returns non-zero if the word starting at the given string contains any tab
+ * or newline.
+ */
+static int
+word_has_special(const char *str)
+{
+	uint64_t w;
+
+	memcpy(&w, str, sizeof(w));
+	return (WORD_HAS(w, '\t') | WORD_HAS(w, '\n')) != 0;
+}
@@ -0,0 +1,275 @@
+#include "watch.h"
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_INOTIFY
+#include <sys/inotify.h>
+#endif
+
+#include <err.h>
+#include <errno.h>
+#include <limits.h>	/* PATH_MAX */
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libks/compiler.h"
+#include "libks/vector.h"
+
+#include "alloc.h"
+#include "file.h"
+
+#ifdef HAVE_INOTIFY
+
+/*
+ * Number of milliseconds without any event before reporting the changed files,
+ * coalescing the burst of events caused by a single save in most editors.
+ */
+#define WATCH_DEBOUNCE	100
+
+#define WATCH_BUFSIZ	4096
+
+struct watch_entry {
+	/* Directory including trailing slash, empty for the current one. */
+	char	*we_dir;
+	/* Name of the watched file, NULL for any source file. */
+	char	*we_name;
+	int	 we_wd;
+};
+
+struct watch {
+	struct watch_entry	*wa_entries;	/* VECTOR(struct watch_entry) */
+	/* Buffer of events, suitably aligned by malloc(3). */
+	char			*wa_buf;
+	int			 wa_fd;
+};
+
+static int	watch_read(struct watch *, struct files *, int *);
+static void	watch_changed(struct files *, const char *, const char *);
+
+static int	issource(const char *);
+
+struct watch *
+watch_alloc(void)
+{
+	struct watch *wa;
+
+	wa = ecalloc(1, sizeof(*wa));
+	if (VECTOR_INIT(wa->wa_entries))
+		err(1, NULL);
+	wa->wa_buf = emalloc(WATCH_BUFSIZ);
+	wa->wa_fd = inotify_init1(IN_CLOEXEC);
+	if (wa->wa_fd == -1) {
+		warn("inotify_init1");
+		watch_free(wa);
+		return NULL;
+	}
+	return wa;
+}
+
+void
+watch_free(struct watch *wa)
+{
+	if (wa == NULL)
+		return;
+
+	while (!VECTOR_EMPTY(wa->wa_entries)) {
+		struct watch_entry *we;
+
+		we = VECTOR_POP(wa->wa_entries);
+		free(we->we_dir);
+		free(we->we_name);
+	}
+	VECTOR_FREE(wa->wa_entries);
+	free(wa->wa_buf);
+	if (wa->wa_fd != -1)
+		close(wa->wa_fd);
+	free(wa);
+}
+
+/*
+ * Watch the given file or all source files in the given directory, excluding
+ * subdirectories. Files are watched through their directory as many editors
+ * replace the file on save. Returns non-zero on error.
+ */
+int
+watch_add(struct watch *wa, const char *path)
+{
+	struct stat sb;
+	struct watch_entry *we;
+	size_t len = strlen(path);
+	int wd;
+
+	if (stat(path, &sb) == -1) {
+		warn("%s", path);
+		return 1;
+	}
+
+	we = VECTOR_CALLOC(wa->wa_entries);
+	if (we == NULL)
+		err(1, NULL);
+	if (S_ISDIR(sb.st_mode)) {
+		we->we_dir = ecalloc(1, len + 2);
+		memcpy(we->we_dir, path, len);
+		if (path[len - 1] != '/')
+			we->we_dir[len] = '/';
+	} else {
+		const char *slash;
+		size_t dirlen;
+
+		slash = strrchr(path, '/');
+		dirlen = slash == NULL ? 0 : (size_t)(slash - path) + 1;
+		we->we_dir = ecalloc(1, dirlen + 1);
+		memcpy(we->we_dir, path, dirlen);
+		we->we_name = estrdup(&path[dirlen]);
+	}
+
+	wd = inotify_add_watch(wa->wa_fd,
+	    we->we_dir[0] != '\0' ? we->we_dir : ".",
+	    IN_CLOSE_WRITE | IN_MOVED_TO);
+	if (wd == -1) {
+		warn("inotify_add_watch: %s", path);
+		return 1;
+	}
+	we->we_wd = wd;
+	return 0;
+}
+
+/*
+ * Wait until one or many watched files change and add them to the given files.
+ * The restyle argument is set if any .clang-format file in a watched directory
+ * changed. Returns non-zero on error.
+ */
+int
+watch_wait(struct watch *wa, struct files *files, int *restyle)
+{
+	struct pollfd pfd = {
+		.fd	= wa->wa_fd,
+		.events	= POLLIN,
+	};
+	int timeout = -1;
+
+	while (VECTOR_EMPTY(files->fs_vc) || timeout != -1) {
+		int n;
+
+		n = poll(&pfd, 1, timeout);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			warn("poll");
+			return 1;
+		}
+		if (n == 0)
+			break;
+		if (watch_read(wa, files, restyle))
+			return 1;
+		/* Keep reading until the burst of events is over. */
+		if (!VECTOR_EMPTY(files->fs_vc) || *restyle)
+			timeout = WATCH_DEBOUNCE;
+	}
+	return 0;
+}
+
+static int
+watch_read(struct watch *wa, struct files *files, int *restyle)
+{
+	const char *p;
+	ssize_t n;
+
+	n = read(wa->wa_fd, wa->wa_buf, WATCH_BUFSIZ);
+	if (n == -1) {
+		if (errno == EINTR || errno == EAGAIN)
+			return 0;
+		warn("read: inotify");
+		return 1;
+	}
+
+	for (p = wa->wa_buf; p < &wa->wa_buf[n];) {
+		const struct inotify_event *ev = (const void *)p;
+		size_t i;
+
+		p += sizeof(*ev) + ev->len;
+		if (ev->len == 0)
+			continue;
+
+		for (i = 0; i < VECTOR_LENGTH(wa->wa_entries); i++) {
+			const struct watch_entry *we = &wa->wa_entries[i];
+
+			if (we->we_wd != ev->wd)
+				continue;
+			if (strcmp(ev->name, ".clang-format") == 0)
+				*restyle = 1;
+			if (we->we_name != NULL ?
+			    strcmp(we->we_name, ev->name) == 0 :
+			    issource(ev->name))
+				watch_changed(files, we->we_dir, ev->name);
+		}
+	}
+	return 0;
+}
+
+/*
+ * Add the given changed file, unless already present.
+ */
+static void
+watch_changed(struct files *files, const char *dir, const char *name)
+{
+	char path[PATH_MAX];
+	size_t i, siz;
+	int n;
+
+	siz = sizeof(path);
+	n = snprintf(path, siz, "%s%s", dir, name);
+	if (n < 0 || (size_t)n >= siz) {
+		warnc(ENAMETOOLONG, "%s%s", dir, name);
+		return;
+	}
+	for (i = 0; i < VECTOR_LENGTH(files->fs_vc); i++) {
+		if (strcmp(files->fs_vc[i].fe_path, path) == 0)
+			return;
+	}
+	files_alloc(files, path);
+}
+
+static int
+issource(const char *name)
+{
+	const char *dot;
+
+	dot = strrchr(name, '.');
+	return dot != NULL && dot != name &&
+	    (strcmp(dot, ".c") == 0 || strcmp(dot, ".h") == 0);
+}
+
+#else
+
+struct watch *
+watch_alloc(void)
+{
+	warnx("watch mode not supported on this platform");
+	return NULL;
+}
+
+void
+watch_free(struct watch *UNUSED(wa))
+{
+}
+
+int
+watch_add(struct watch *UNUSED(wa), const char *UNUSED(path))
+{
+	return 1;
+}
+
+int
+watch_wait(struct watch *UNUSED(wa), struct files *UNUSED(files),
+    int *UNUSED(restyle))
+{
+	return 1;
+}
+
+#endif
@@ -0,0 +1,6 @@
+struct files;
+
+struct watch	*watch_alloc(void);
+void		 watch_free(struct watch *);
+int		 watch_add(struct watch *, const char *);
+int		 watch_wait(struct watch *, struct files *, int *);